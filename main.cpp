@@ -9,6 +9,9 @@
 #include <vector>
 #include <chrono>
 #include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
 #include <cmath>
 #include <algorithm>
 #include <limits>
@@ -18,9 +21,267 @@
 #include <deque>
 #include <unordered_set>
 #include <cctype>
+#include <cstdlib>
 #include <set>
 #include <functional>
+#include <memory>
 #include <iomanip>
+#include <cstring>
+#include <new>
+#include <cassert>
+#include <cstdint>
+#include <string_view>
+#include <type_traits>
+#include <filesystem>
+#include <cerrno>
+
+// Memory-mapped file access for baked level bundles
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// File change notifications for hot reload
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+// SIMD support for the NPC steering kernels (selected at runtime)
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define NPC_SIMD_X86 1
+#include <immintrin.h>
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define NPC_SIMD_NEON 1
+#include <arm_neon.h>
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define SIMD_TARGET(isa) __attribute__((target(isa)))
+#else
+#define SIMD_TARGET(isa)
+#endif
+
+// Logging. Messages are formatted into a fixed buffer on the calling thread
+// and pushed into a lock-free ring that a background thread drains to
+// stdout/stderr, so logging never blocks or flushes on the hot path. When
+// the ring is full, messages are dropped and counted. Levels below
+// LOG_COMPILE_LEVEL (e.g. -DLOG_COMPILE_LEVEL=LOG_WARN) are compiled out;
+// logLevel filters the rest at runtime (--log-level=debug|info|warn|error|off).
+enum LogLevel { LOG_DEBUG, LOG_INFO, LOG_WARN, LOG_ERROR, LOG_OFF };
+#ifndef LOG_COMPILE_LEVEL
+#define LOG_COMPILE_LEVEL LOG_DEBUG
+#endif
+const char* const logLevelNames[LOG_OFF] = {"debug", "info", "warn", "error"};
+int logLevel = LOG_INFO;
+
+struct Logger {
+    static constexpr size_t CAPACITY = 1024;     // Queued messages; a power of two
+    static constexpr size_t MESSAGE_SIZE = 256;  // Longer messages are truncated
+
+    // Ring slot; sequence tells producers and the consumer whose turn it is
+    struct Slot {
+        std::atomic<size_t> sequence{0};
+        int level = LOG_INFO;
+        size_t length = 0;
+        char text[MESSAGE_SIZE];
+    };
+
+    std::unique_ptr<Slot[]> slots{new Slot[CAPACITY]};
+    std::atomic<size_t> enqueuePos{0};
+    size_t dequeuePos = 0;                   // Consumer only
+    std::atomic<Uint64> dropped{0};
+    std::thread worker;
+    std::atomic<bool> running{false};
+
+    Logger() {
+        for (size_t i = 0; i < CAPACITY; i++) slots[i].sequence.store(i, std::memory_order_relaxed);
+    }
+    ~Logger() { stop(); }
+
+    // Queue a message from any thread; false if the ring is full
+    bool push(int level, const char* text, size_t length) {
+        size_t pos = enqueuePos.load(std::memory_order_relaxed);
+        Slot* slot;
+        while (true) {
+            slot = &slots[pos & (CAPACITY - 1)];
+            size_t sequence = slot->sequence.load(std::memory_order_acquire);
+            if (sequence == pos) {
+                if (enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+            } else if (sequence < pos) {
+                dropped.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            } else {
+                pos = enqueuePos.load(std::memory_order_relaxed);
+            }
+        }
+        slot->level = level;
+        slot->length = std::min(length, MESSAGE_SIZE);
+        std::memcpy(slot->text, text, slot->length);
+        slot->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Write out every queued message; called by the drain thread only, or by
+    // whoever stops the logger once the thread is gone
+    void drain() {
+        bool wrote = false;
+        while (true) {
+            Slot& slot = slots[dequeuePos & (CAPACITY - 1)];
+            if (slot.sequence.load(std::memory_order_acquire) != dequeuePos + 1) break;
+            std::ostream& out = slot.level >= LOG_WARN ? std::cerr : std::cout;
+            out << '[' << logLevelNames[slot.level] << "] ";
+            out.write(slot.text, slot.length);
+            out << '\n';
+            slot.sequence.store(dequeuePos + CAPACITY, std::memory_order_release);
+            dequeuePos++;
+            wrote = true;
+        }
+        if (Uint64 lost = dropped.exchange(0)) {
+            std::cerr << "[warn] " << lost << " log messages dropped\n";
+            wrote = true;
+        }
+        if (wrote) {
+            std::cout.flush();
+            std::cerr.flush();
+        }
+    }
+
+    void start() {
+        if (worker.joinable()) return;
+        running = true;
+        worker = std::thread([this]() {
+            while (running) {
+                drain();
+                std::this_thread::sleep_for(std::chrono::milliseconds(5));
+            }
+            drain();
+        });
+    }
+
+    void stop() {
+        if (worker.joinable()) {
+            running = false;
+            worker.join();
+        } else {
+            drain();
+        }
+    }
+};
+
+Logger logger;
+
+// Per-thread formatting buffer for one message; never allocates
+struct LogLine : std::ostream {
+    struct Buffer : std::streambuf {
+        char text[Logger::MESSAGE_SIZE];
+        void reset() { setp(text, text + sizeof(text)); }
+        size_t length() const { return pptr() - pbase(); }
+    } buffer;
+
+    LogLine() : std::ostream(nullptr) { rdbuf(&buffer); }
+
+    // Empty the buffer and restore default formatting
+    LogLine& begin() {
+        buffer.reset();
+        clear();
+        flags(std::ios_base::dec | std::ios_base::skipws);
+        precision(6);
+        return *this;
+    }
+};
+
+inline LogLine& beginLogLine() {
+    static thread_local LogLine line;
+    return line.begin();
+}
+
+// Lets through one message per second from a call site, counting the rest
+struct LogRateLimit {
+    typedef std::chrono::steady_clock Clock;
+    std::atomic<Clock::rep> nextAllowed{0};  // Clock ticks
+    std::atomic<Uint32> suppressed{0};
+
+    bool allow(Uint32& skipped) {
+        const Clock::rep interval = std::chrono::duration_cast<Clock::duration>(std::chrono::seconds(1)).count();
+        Clock::rep now = Clock::now().time_since_epoch().count();
+        Clock::rep next = nextAllowed.load(std::memory_order_relaxed);
+        if (now < next || !nextAllowed.compare_exchange_strong(next, now + interval)) {
+            suppressed.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        skipped = suppressed.exchange(0);
+        return true;
+    }
+};
+
+// LOG(LOG_WARN, "Missing " << name); the message is only formatted when the
+// level is enabled
+#define LOG(level, message)                                                   \
+    do {                                                                      \
+        if constexpr ((level) >= LOG_COMPILE_LEVEL) {                         \
+            if ((level) >= logLevel) {                                        \
+                LogLine& logLine = beginLogLine();                            \
+                logLine << message;                                           \
+                logger.push(level, logLine.buffer.text, logLine.buffer.length()); \
+            }                                                                 \
+        }                                                                     \
+    } while (0)
+
+// LOG() for messages that can repeat every frame: at most one per second
+// from each call site, noting how many were suppressed in between
+#define LOG_RATE_LIMITED(level, message)                                      \
+    do {                                                                      \
+        if constexpr ((level) >= LOG_COMPILE_LEVEL) {                         \
+            static LogRateLimit logLimit;                                     \
+            Uint32 logSkipped = 0;                                            \
+            if ((level) >= logLevel && logLimit.allow(logSkipped)) {          \
+                LogLine& logLine = beginLogLine();                            \
+                logLine << message;                                           \
+                if (logSkipped) logLine << " (" << logSkipped << " repeats suppressed)"; \
+                logger.push(level, logLine.buffer.text, logLine.buffer.length()); \
+            }                                                                 \
+        }                                                                     \
+    } while (0)
+
+// Interned identifiers used on the hot path instead of strings
+typedef int NameId;  // Index into nameTable
+typedef int AnimId;  // Index into animations
+const NameId INVALID_NAME = -1;
+const AnimId INVALID_ANIM = -1;
+
+// Name interning table
+std::vector<std::string> nameTable;                   // NameId -> name
+std::unordered_map<std::string, NameId> nameLookup;   // name -> NameId
+
+// Return the ID for a name, adding it to the table on first use
+NameId internName(const std::string& name) {
+    auto it = nameLookup.find(name);
+    if (it != nameLookup.end()) return it->second;
+    NameId id = static_cast<NameId>(nameTable.size());
+    nameTable.push_back(name);
+    nameLookup[name] = id;
+    return id;
+}
+
+// Sprite kinds with special behaviour
+const NameId kindBackground = internName("background");
+const NameId kindPlayer = internName("aaron");
+const NameId kindReyna = internName("reyna");
+const NameId kindCursor = internName("cursor");
+
+// Image stored inside a shared atlas page texture
+struct AtlasRegion {
+    SDL_Texture* page = nullptr;   // Atlas page (or standalone texture)
+    SDL_Rect src = {0, 0, 0, 0};   // Pixel rectangle inside the page
+    float u0 = 0.0f, v0 = 0.0f;    // Normalized texture coordinates of src
+    float u1 = 1.0f, v1 = 1.0f;
+};
 
 // Structure representing a game sprite with rendering and collision properties
 struct GameSprite {
@@ -28,21 +289,33 @@ struct GameSprite {
     SDL_Rect footRect;       // Bottom rectangle for depth sorting and collision
     int footW;               // Width of foot rectangle
     int footH;               // Height of foot rectangle
-    SDL_Texture* currentTexture;  // Current texture to render
-    std::string spriteName;  // Identifier for the sprite
+    AtlasRegion currentImage;  // Current image to render (atlas page + source rect)
+    NameId kind;             // Interned sprite name
     int currentFrame;        // Current animation frame
     bool isAnimated;         // Flag for animated sprites
     bool isMoving;           // Movement state flag
     bool facingLeft = false; // Direction sprite is facing
+    float posX = 0.0f;           // Sub-pixel world position; rect and footRect are derived from it
+    float posY = 0.0f;
+    SDL_FPoint prevPos = {0.0f, 0.0f};  // Position at the previous tick, for render interpolation
+
+    // Derive the integer rect and footRect from the float position
+    void syncRects() {
+        rect.x = static_cast<int>(std::floor(posX));
+        rect.y = static_cast<int>(std::floor(posY));
+        footRect.x = rect.x + (rect.w - footW) / 2;
+        footRect.y = rect.y + rect.h - footH;
+    }
 
-    float animAccumulator = 0.0f;  // Time accumulator for animation timing
-    std::string currentAnimName;  // Add this field to store current animation name
+    double animStart = 0.0;  // animationClock time of frame 0; a fixed phase offset for shared playback
+    AnimId currentAnim = INVALID_ANIM;  // Current animation (index into animations)
+    bool alive = true;       // False while the slot is free for reuse
 
     // Custom comparison operator for depth sorting
     bool operator<(const GameSprite& other) const {
         // Background always renders first
-        if (spriteName == "background") return true;
-        if (other.spriteName == "background") return false;
+        if (kind == kindBackground) return true;
+        if (other.kind == kindBackground) return false;
         
         // Sort by bottom position of footRect for pseudo-3D effect
         int thisBottom = footRect.y + footRect.h;
@@ -50,13 +323,24 @@ struct GameSprite {
         
         if (thisBottom != otherBottom) return thisBottom < otherBottom;
         if (footRect.x != other.footRect.x) return footRect.x < other.footRect.x;
-        return spriteName < other.spriteName;
+        return kind < other.kind;
     }
 };
 
+// Sprites that never move or animate: props for the foot hash, and cached
+// in the static layers by the renderer
+inline bool isStaticSprite(const GameSprite& s) {
+    return !s.isAnimated && s.kind != kindPlayer;
+}
+
 // Forward declarations for functions
 bool loadMapFile(const std::string& mapFilePath);
+bool loadBundle(const std::string& bundlePath);
 void updateNPCs();
+void sortDrawOrder();
+void markStaticLayers(const SDL_Rect& area);
+void invalidateStaticLayers();
+void clearStaticLayers();
 void debugPlayerAnimation(const GameSprite& sprite);
 
 // Global SDL objects
@@ -65,14 +349,22 @@ SDL_Renderer* renderer = nullptr;
 TTF_Font* font = nullptr;
 
 // Timing variables for frame management
-double deltaTime = 0.0;     // Time since last frame
+double deltaTime = 0.0;     // Simulation step length (seconds), fixed per tick
+double frameTime = 0.0;     // Wall-clock time of the last rendered frame
 Uint64 lastFrameTime = 0;   // Timestamp of last frame
+double tickRate = 60.0;     // Simulation ticks per second (--tick-rate=N)
+float renderAlpha = 1.0f;   // Interpolation factor between previous and current tick
+bool vsyncEnabled = true;   // Present with vsync (--no-vsync to disable)
+bool headlessMode = false;  // Hidden window, software renderer, dummy drivers (--headless)
+const double MAX_FRAME_TIME = 0.25;  // Clamp long frames so the tick loop cannot spiral
 
 // Game world dimensions
 const int SCREEN_WIDTH = 800;   // Window width
 const int SCREEN_HEIGHT = 600;  // Window height
-const int MAP_WIDTH = 1600;     // Total map width
-const int MAP_HEIGHT = 1200;    // Total map height
+const int MAP_WIDTH = 1600;     // Default map width
+const int MAP_HEIGHT = 1200;    // Default map height
+int worldWidth = MAP_WIDTH;     // Current level's world size ([WORLD] section)
+int worldHeight = MAP_HEIGHT;
 float PLAYER_SPEED = 33.0f;     // Player movement speed
 
 // NPC behavior parameters
@@ -80,6 +372,22 @@ const float NPC_SPEED = 55.0f;         // Base NPC movement speed
 const float DETECTION_RADIUS = 60.0f; // Player detection range
 const float WANDER_CHANGE_TIME = 2.0f; // Time between wander direction changes
 
+// NPC simulation level of detail: NPCs that are visible or near the player
+// update every tick, mid-range ones every few ticks with a scaled step, and
+// far ones only advance their timers. Updates are staggered by EntityId.
+enum NPCTier { NPC_TIER_NEAR, NPC_TIER_MID, NPC_TIER_FAR, NPC_TIER_COUNT };
+const float NPC_LOD_NEAR_DISTANCE = 320.0f;  // Player distance updated every tick
+const float NPC_LOD_MID_DISTANCE = 960.0f;   // Player distance of the mid tier
+const int NPC_LOD_VIEW_MARGIN = 64;          // NPCs this close to the view count as visible
+const int NPC_LOD_MID_INTERVAL = 4;          // Ticks between mid-tier updates
+const int NPC_LOD_FAR_INTERVAL = 16;         // Ticks between far-tier timer updates
+
+// NPC crowd behavior, using the foot-rect broadphase
+const float NPC_SEPARATION_RADIUS = 12.0f;   // NPCs closer than this push apart
+const float NPC_SEPARATION_SPEED = 0.5f;     // Push speed as a fraction of NPC_SPEED
+const float NPC_AGGRO_RADIUS = 40.0f;        // Same-kind NPCs this close join a chase...
+const float NPC_AGGRO_RANGE = 180.0f;        // ...while within this distance of the player
+
 // NPC state tracking structure
 struct NPCState {
     bool isFollowing = false;   // Following player state
@@ -87,14 +395,144 @@ struct NPCState {
     bool isWandering = true;
     float wanderTimer = 0.0f;   // Timer for wander direction
     float wanderAngle = 0.0f;   // Current wander direction angle
+    Uint32 rngState = 0;        // Per-NPC xorshift state, so updates can run on any thread
 };
 
-// Map of NPC states keyed by unique identifiers
-std::unordered_map<std::string, NPCState> npcStates;
+// Advance an xorshift32 generator and return a value in [0, 1)
+inline float nextRandom(Uint32& state) {
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return (state >> 8) * (1.0f / 16777216.0f);
+}
+
+Uint32 simulationSeed = 0;  // Mixed into every per-entity random stream (--seed=N)
+
+// NPC states, parallel to gameSprites and indexed by EntityId
+std::vector<NPCState> npcStates;
 
 // Global rendering scale factor
 float globalScale = 3.0f;
 
+// Cache static sprites in per-chunk render targets (--no-static-layers to disable)
+bool staticLayersEnabled = true;
+int maxStaticLayerSize = 0;  // Largest layer texture edge the renderer supports, 0 when unknown
+
+// Sprite submission backend (--renderer=batched|copy), to compare both paths
+enum SpriteBackend { SPRITE_BACKEND_BATCHED, SPRITE_BACKEND_COPY };
+SpriteBackend spriteBackend = SPRITE_BACKEND_BATCHED;
+
+// Fixed pool of worker threads that execute parallel-for loops together with
+// the calling thread. Chunks are claimed dynamically from a shared counter,
+// so uneven work balances itself across threads.
+struct JobSystem {
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable wake;      // Signals workers that a job or shutdown is pending
+    std::condition_variable done;      // Signals the caller that the job has drained
+
+    // Current job as a non-owning callable (no std::function, so submitting a
+    // job never allocates); only modified by the caller while no worker is active
+    const void* jobContext = nullptr;
+    void (*jobCall)(const void*, size_t, size_t) = nullptr;
+    size_t jobCount = 0;
+    size_t jobGrain = 1;
+    bool jobActive = false;
+    Uint64 generation = 0;             // Incremented for every job
+    std::atomic<size_t> nextIndex{0};  // Next unclaimed index
+    std::atomic<size_t> remaining{0};  // Chunks not yet finished
+    int activeWorkers = 0;             // Workers currently running chunks
+    bool stopping = false;
+
+    ~JobSystem() { stop(); }
+
+    // Spawn worker threads (0 runs every job on the caller)
+    void start(unsigned workerCount) {
+        stop();
+        stopping = false;
+        for (unsigned i = 0; i < workerCount; i++) {
+            workers.emplace_back([this] { workerLoop(); });
+        }
+    }
+
+    // Join all worker threads
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto& t : workers) t.join();
+        workers.clear();
+    }
+
+    // Claim and run one chunk of the current job; false when none are left
+    bool runChunk() {
+        size_t begin = nextIndex.fetch_add(jobGrain);
+        if (begin >= jobCount) return false;
+        jobCall(jobContext, begin, std::min(jobCount, begin + jobGrain));
+        if (remaining.fetch_sub(1) == 1) {
+            std::lock_guard<std::mutex> lock(mutex);
+            done.notify_all();
+        }
+        return true;
+    }
+
+    void workerLoop() {
+        Uint64 seen = 0;
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            wake.wait(lock, [&] { return stopping || (jobActive && generation != seen); });
+            if (stopping) return;
+            seen = generation;
+            activeWorkers++;
+            lock.unlock();
+            while (runChunk()) {}
+            lock.lock();
+            if (--activeWorkers == 0) done.notify_all();
+        }
+    }
+
+    // Run fn(begin, end) over [0, count) in chunks of at most grain elements
+    // on all threads; returns once every chunk has finished
+    template <typename Fn>
+    void parallelFor(size_t count, size_t grain, const Fn& fn) {
+        if (count == 0) return;
+        grain = std::max<size_t>(1, grain);
+        if (workers.empty() || count <= grain) {
+            fn(0, count);
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            jobContext = &fn;
+            jobCall = [](const void* context, size_t begin, size_t end) {
+                (*static_cast<const Fn*>(context))(begin, end);
+            };
+            jobCount = count;
+            jobGrain = grain;
+            nextIndex = 0;
+            remaining = (count + grain - 1) / grain;
+            jobActive = true;
+            generation++;
+        }
+        wake.notify_all();
+
+        while (runChunk()) {}
+
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [&] { return remaining == 0 && activeWorkers == 0; });
+        jobActive = false;
+        jobContext = nullptr;
+        jobCall = nullptr;
+    }
+};
+
+JobSystem jobSystem;           // Shared worker pool
+unsigned workerThreads = std::max(1u, std::thread::hardware_concurrency()) - 1;  // --threads=N overrides
+const size_t NPC_JOB_GRAIN = 256;  // NPCs per parallel chunk
+
 // Custom comparator for SDL_Rect sorting by Y position
 struct CompareSDLRectByY {
     bool operator()(const SDL_Rect& a, const SDL_Rect& b) const {
@@ -110,735 +548,4383 @@ std::set<SDL_Rect, CompareSDLRectByY> static_texture_rects;
 // Animation structure definition
 struct animation {
     std::string name;             // Animation name
-    std::vector<SDL_Texture*> frames;  // Texture frames
+    std::vector<AtlasRegion> frames;   // Frame images in the atlas
     int frameCount;               // Total frames
-    int currentFrame;             // Current frame index
     int frameDelay;               // Delay between frames (ms)
     int footW;                    // Foot rectangle width
     int footH;                    // Foot rectangle height
+    bool onDemand = false;        // Frames load on first use, see AnimationLoader
+
+    // Length of one loop in seconds; timing does not depend on the frames
+    // being resident
+    double duration() const { return frameCount * frameDelay / 1000.0; }
+
+    // Frame shown t seconds into the looping timeline
+    int frameAt(double t) const {
+        if (frameCount <= 0 || frameDelay <= 0) return 0;
+        long long step = static_cast<long long>(std::floor(t * 1000.0 / frameDelay));
+        long long n = static_cast<long long>(frameCount);
+        return static_cast<int>(((step % n) + n) % n);
+    }
 };
 
-// Game object containers
-std::set<GameSprite> gameSprites;  // All active sprites
-SDL_Point backgroundOffset = {0, 0};  // Camera offset
-SDL_Rect playerRect;                // Player position (deprecated)
-SDL_Rect backgroundRect;            // Background position (deprecated)
+// Animation playback is a function of time rather than per-sprite state:
+// a sprite shows frameAt(animationClock - animStart) of its current
+// animation. Decor shares the global clock with a per-instance phase offset
+// fixed at spawn; individually driven sprites (the player) restart their
+// timeline by setting animStart when they switch animations.
+double animationClock = 0.0;  // Simulation time in seconds, advanced every tick
 
-// Asset storage
-std::unordered_map<std::string, SDL_Texture*> textureMap;  // Texture cache
-std::unordered_map<std::string, animation> animationMap;   // Animation data
-std::unordered_map<std::string, SDL_Point> textureFootMap; // Foot dimensions
+// Stable handle into the entity store
+typedef size_t EntityId;
+const EntityId INVALID_ENTITY = std::numeric_limits<EntityId>::max();
 
-// Performance tracking
-double currentFPS = 0.0;                     // Current FPS value
-std::deque<double> fpsHistory;                // FPS history buffer
-const size_t FPS_HISTORY_SIZE = 60;           // History buffer size
+// Uniform grid over world space indexing sprite rects for culling and picking
+struct SpatialGrid {
+    // Range of cells covered by one entity (inclusive)
+    struct CellRange {
+        int x0, y0, x1, y1;
+        bool operator==(const CellRange& o) const { return x0 == o.x0 && y0 == o.y0 && x1 == o.x1 && y1 == o.y1; }
+    };
 
-// Mouse cursor
-GameSprite* cursor = nullptr;  // Custom cursor sprite
+    static const int MAX_CELLS_PER_ENTITY = 64;  // Larger entities go to the oversized list
 
-// Facing directions
-enum class PlayerFacing { N, S, NE, SE, NW, SW };
-static PlayerFacing   g_playerFacing = PlayerFacing::S;
-static char           g_lastVertical = 'S';  // 'N' or 'S'
+    // Entity in a cell, chained per cell; links come from one pool, so
+    // entities moving between cells never allocate once the pool has grown
+    struct CellLink {
+        EntityId id;
+        Uint32 next;
+    };
+    static constexpr Uint32 NO_LINK = 0xFFFFFFFFu;
 
-// Initialize SDL and create window/renderer
-bool initSDL() {
-    // Initialize all SDL subsystems
-    if (SDL_Init(SDL_INIT_EVERYTHING) < 0) {
-        std::cerr << "SDL could not initialize! SDL_Error: " << SDL_GetError() << std::endl;
-        return false;
-    }
+    int cellSize = 64;                           // Cell edge length in world units
+    int cols = 0, rows = 0;                      // Grid dimensions in cells
+    std::vector<Uint32> cellHeads;               // First link per cell, NO_LINK when empty
+    std::vector<CellLink> links;                 // Link pool
+    Uint32 freeLinks = NO_LINK;                  // Chain of unused links in the pool
+    std::vector<EntityId> oversized;             // Entities tested on every query (e.g. background)
+    std::vector<CellRange> ranges;               // Cell range per entity, {-1,...} when oversized
+    std::vector<Uint32> queryMarks;              // Per-entity stamp used to de-duplicate query results
+    Uint32 queryStamp = 0;
 
-    // Create game window
-    window = SDL_CreateWindow("Space Monkeys", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, 800, 600, SDL_WINDOW_SHOWN);
-    if (!window) {
-        std::cerr << "Window could not be created! SDL_Error: " << SDL_GetError() << std::endl;
-        SDL_Quit();
-        return false;
-    }
+    SpatialGrid(int worldW, int worldH, int cell) { reset(worldW, worldH, cell); }
 
-    // Create hardware-accelerated renderer with VSync
-    renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_PRESENTVSYNC);
-    if (!renderer) {
-        std::cerr << "Renderer could not be created! SDL Error: " << SDL_GetError() << std::endl;
-        SDL_DestroyWindow(window);
-        SDL_Quit();
-        return false;
+    // Drop all entities and resize the grid to cover the world
+    void reset(int worldW, int worldH, int cell) {
+        cellSize = cell;
+        cols = (worldW + cellSize - 1) / cellSize;
+        rows = (worldH + cellSize - 1) / cellSize;
+        cellHeads.assign(cols * rows, NO_LINK);
+        links.clear();
+        freeLinks = NO_LINK;
+        oversized.clear();
+        ranges.clear();
+        queryMarks.clear();
+        queryStamp = 0;
     }
 
-    // Initialize image loading support (PNG & JPG)
-    if (IMG_Init(IMG_INIT_PNG | IMG_INIT_JPG) == 0) {
-        std::cerr << "SDL_image could not initialize! SDL_image Error: " << IMG_GetError() << std::endl;
-        SDL_DestroyRenderer(renderer);
-        SDL_DestroyWindow(window);
-        SDL_Quit();
-        return false;
+    // Cells overlapped by a rect, clamped to the grid
+    CellRange rangeFor(const SDL_Rect& r) const {
+        CellRange c;
+        c.x0 = std::clamp(r.x / cellSize, 0, cols - 1);
+        c.y0 = std::clamp(r.y / cellSize, 0, rows - 1);
+        c.x1 = std::clamp((r.x + std::max(r.w, 1) - 1) / cellSize, 0, cols - 1);
+        c.y1 = std::clamp((r.y + std::max(r.h, 1) - 1) / cellSize, 0, rows - 1);
+        return c;
     }
 
-    // Initialize audio mixer
-    if (Mix_OpenAudio(44100, MIX_DEFAULT_FORMAT, 2, 2048) < 0) {
-        std::cerr << "SDL_mixer could not initialize! SDL_mixer Error: " << Mix_GetError() << std::endl;
-        IMG_Quit();
-        SDL_DestroyRenderer(renderer);
-        SDL_DestroyWindow(window);
-        SDL_Quit();
-        return false;
+    void link(EntityId id, const CellRange& c) {
+        if ((c.x1 - c.x0 + 1) * (c.y1 - c.y0 + 1) > MAX_CELLS_PER_ENTITY) {
+            oversized.push_back(id);
+            ranges[id] = {-1, -1, -1, -1};
+            return;
+        }
+        for (int y = c.y0; y <= c.y1; y++) {
+            for (int x = c.x0; x <= c.x1; x++) {
+                Uint32 link = freeLinks;
+                if (link != NO_LINK) {
+                    freeLinks = links[link].next;
+                } else {
+                    link = static_cast<Uint32>(links.size());
+                    links.push_back({});
+                }
+                Uint32& head = cellHeads[y * cols + x];
+                links[link] = {id, head};
+                head = link;
+            }
+        }
+        ranges[id] = c;
     }
 
-    // Initialize font rendering
-    if (TTF_Init() == -1) {
-        std::cerr << "SDL_ttf could not initialize! SDL_ttf Error: " << TTF_GetError() << std::endl;
-        Mix_CloseAudio();
-        IMG_Quit();
-        SDL_DestroyRenderer(renderer);
-        SDL_DestroyWindow(window);
-        SDL_Quit();
-        return false;
+    void unlink(EntityId id) {
+        const CellRange c = ranges[id];
+        if (c.x0 < 0) {
+            oversized.erase(std::remove(oversized.begin(), oversized.end(), id), oversized.end());
+            return;
+        }
+        for (int y = c.y0; y <= c.y1; y++) {
+            for (int x = c.x0; x <= c.x1; x++) {
+                Uint32* at = &cellHeads[y * cols + x];
+                while (*at != NO_LINK && links[*at].id != id) at = &links[*at].next;
+                if (*at == NO_LINK) continue;
+                Uint32 link = *at;
+                *at = links[link].next;
+                links[link].next = freeLinks;
+                freeLinks = link;
+            }
+        }
     }
 
-    // Load main font
-    font = TTF_OpenFont("assets/fonts/arial.ttf", 16);
-    if (!font) {
-        std::cerr << "Failed to load font! SDL_ttf Error: " << TTF_GetError() << std::endl;
-        // Proceed without font if loading fails
+    // Add an entity with its world rect
+    void insert(EntityId id, const SDL_Rect& r) {
+        if (ranges.size() <= id) {
+            ranges.resize(id + 1, {-1, -1, -1, -1});
+            queryMarks.resize(id + 1, 0);
+        }
+        link(id, rangeFor(r));
     }
 
-    // Create custom cursor
-    SDL_Surface* cursorSurface = IMG_Load("assets/textures/cursor.png");
-    if (!cursorSurface) {
-        std::cerr << "Failed to load cursor texture! SDL_image Error: " << IMG_GetError() << std::endl;
-        return false;
+    // Re-index an entity after it moved; cheap when it stays in the same cells
+    void update(EntityId id, const SDL_Rect& r) {
+        if (ranges[id].x0 < 0) return;  // Oversized entities stay oversized
+        CellRange c = rangeFor(r);
+        if (c == ranges[id]) return;
+        unlink(id);
+        link(id, c);
     }
 
-    SDL_Texture* cursorTexture = SDL_CreateTextureFromSurface(renderer, cursorSurface);
-    if (!cursorTexture) {
-        std::cerr << "Failed to create cursor texture! SDL Error: " << SDL_GetError() << std::endl;
-        SDL_FreeSurface(cursorSurface);
-        return false;
+    // Collect entities whose rect intersects area, each at most once
+    void query(const SDL_Rect& area, const std::vector<GameSprite>& sprites, std::vector<EntityId>& out) {
+        out.clear();
+        if (++queryStamp == 0) {
+            std::fill(queryMarks.begin(), queryMarks.end(), 0);
+            queryStamp = 1;
+        }
+        auto test = [&](EntityId id) {
+            if (queryMarks[id] == queryStamp) return;
+            queryMarks[id] = queryStamp;
+            if (SDL_HasIntersection(&sprites[id].rect, &area)) out.push_back(id);
+        };
+        for (EntityId id : oversized) test(id);
+        CellRange c = rangeFor(area);
+        for (int y = c.y0; y <= c.y1; y++)
+            for (int x = c.x0; x <= c.x1; x++)
+                for (Uint32 l = cellHeads[y * cols + x]; l != NO_LINK; l = links[l].next) test(links[l].id);
     }
 
-    int w = cursorSurface->w;
-    int h = cursorSurface->h;
-    cursor = new GameSprite{{0, 0, w, h}, {0, 0, w, h}, w, h, cursorTexture, "cursor", 0, false, false};
-    SDL_FreeSurface(cursorSurface);
-    return true;
-}
-
-// Render text to the screen
-void renderText(const std::string& text, SDL_Color color, int x, int y) {
-    if (!font) return; // Skip if no font loaded
-    
-    // Create text surface
-    SDL_Surface* surface = TTF_RenderText_Solid(font, text.c_str(), color);
-    if (!surface) {
-        std::cerr << "Unable to render text surface! SDL_ttf Error: " << TTF_GetError() << std::endl;
-        return;
+    // Collect entities in the cell containing a world point (no rect test)
+    void queryCell(int wx, int wy, std::vector<EntityId>& out) const {
+        out.assign(oversized.begin(), oversized.end());
+        if (wx < 0 || wy < 0 || wx >= cols * cellSize || wy >= rows * cellSize) return;
+        for (Uint32 l = cellHeads[(wy / cellSize) * cols + (wx / cellSize)]; l != NO_LINK; l = links[l].next) {
+            out.push_back(links[l].id);
+        }
     }
+};
 
-    // Convert surface to texture
-    SDL_Texture* texture = SDL_CreateTextureFromSurface(renderer, surface);
-    if (!texture) {
-        std::cerr << "Unable to create texture from rendered text! SDL Error: " << SDL_GetError() << std::endl;
-        SDL_FreeSurface(surface);
-        return;
-    }
+// Broadphase over foot rectangles for proximity and collision queries. A
+// uniform grid of cells is hashed into a table that is rebuilt each tick
+// with a counting sort, so it covers worlds of any size without per-cell
+// storage. Each entity is stored once, in the cell of its foot center, and
+// queries widen their search by the largest foot extent; the table is
+// read-only between builds, so queries are safe from any thread.
+struct SpatialHash {
+    struct Entry {
+        EntityId id;
+        SDL_Rect foot;        // Foot rectangle when the table was built
+        NameId kind;
+        int cellX, cellY;     // Cell of the foot center
+        bool isStatic;        // Props that block movement
+        bool following;       // NPC was chasing the player last tick
+    };
 
-    // Render texture to screen
-    SDL_Rect destRect = {x, y, surface->w, surface->h};
-    SDL_RenderCopy(renderer, texture, NULL, &destRect);
-    
-    // Cleanup resources
-    SDL_FreeSurface(surface);
-    SDL_DestroyTexture(texture);
-}
+    int cellSize = 32;                 // Cell edge length in world units
+    size_t tableMask = 0;              // Table size - 1 (power of two)
+    std::vector<Uint32> bucketStart;   // Start of each bucket in entries, plus an end marker
+    std::vector<Entry> entries;        // Grouped by bucket
+    std::vector<Entry> scratch;        // Unsorted entries during build
+    std::vector<Uint32> scratchBuckets;  // Bucket of each scratch entry
+    std::vector<Uint32> bucketCursor;    // Next free slot per bucket during build
+    int maxHalfW = 0, maxHalfH = 0;    // Largest foot half extents in the table
 
-// Load textures from a manifest file
-void loadTexturesFromFile(const std::string& filePath) {
-    std::ifstream file(filePath);
-    if (!file.is_open()) {
-        std::cerr << "Could not open file: " << filePath << std::endl;
-        return;
+    static int cellOf(int v, int size) { return v >= 0 ? v / size : -((-v + size - 1) / size); }
+
+    size_t bucketOf(int cx, int cy) const {
+        return ((static_cast<Uint32>(cx) * 73856093u) ^ (static_cast<Uint32>(cy) * 19349663u)) & tableMask;
     }
 
-    std::string line;
-    while (std::getline(file, line)) {
-        // Load image file
-        SDL_Surface* surface = IMG_Load(line.c_str());
-        if (!surface) {
-            std::cerr << "Unable to load texture: " << line << " Error: " << IMG_GetError() << std::endl;
-            continue;
+    // Index every live sprite with a foot rectangle (the background has none)
+    void build(const std::vector<GameSprite>& sprites, int cell) {
+        cellSize = cell;
+        scratch.clear();
+        scratchBuckets.clear();
+        maxHalfW = maxHalfH = 0;
+        for (EntityId id = 0; id < sprites.size(); id++) {
+            const GameSprite& s = sprites[id];
+            if (!s.alive || s.footRect.w <= 0 || s.footRect.h <= 0) continue;
+            int cx = cellOf(s.footRect.x + s.footRect.w / 2, cellSize);
+            int cy = cellOf(s.footRect.y + s.footRect.h / 2, cellSize);
+            scratch.push_back({id, s.footRect, s.kind, cx, cy, isStaticSprite(s), npcStates[id].isFollowing});
+            maxHalfW = std::max(maxHalfW, (s.footRect.w + 1) / 2);
+            maxHalfH = std::max(maxHalfH, (s.footRect.h + 1) / 2);
         }
 
-        // Create texture from surface
-        SDL_Texture* texture = SDL_CreateTextureFromSurface(renderer, surface);
-        if (!texture) {
-            std::cerr << "Unable to create texture! SDL Error: " << SDL_GetError() << std::endl;
-            SDL_FreeSurface(surface);
-            continue;
+        size_t tableSize = 64;
+        while (tableSize < scratch.size() * 2) tableSize *= 2;
+        tableMask = tableSize - 1;
+
+        // Counting sort of the entries by bucket
+        bucketStart.assign(tableSize + 1, 0);
+        for (const Entry& e : scratch) {
+            scratchBuckets.push_back(static_cast<Uint32>(bucketOf(e.cellX, e.cellY)));
+            bucketStart[scratchBuckets.back() + 1]++;
         }
+        for (size_t b = 0; b < tableSize; b++) bucketStart[b + 1] += bucketStart[b];
+        entries.resize(scratch.size());
+        bucketCursor.assign(bucketStart.begin(), bucketStart.end() - 1);
+        for (size_t i = 0; i < scratch.size(); i++) entries[bucketCursor[scratchBuckets[i]]++] = scratch[i];
+    }
 
-        // Extract texture name from path
-        std::string textureName = line.substr(line.find_last_of("/\\") + 1);
-        textureName = textureName.substr(0, textureName.find('.'));
-        
-        // Create sprite with default values
-        GameSprite sprite{
-            {0, 0, surface->w, surface->h},  // rect
-            {0, 0, 32, 32},                  // footRect (default size)
-            32,                              // footW
-            32,                              // footH
-            texture,                         // currentTexture
-            textureName,                     // spriteName
-            0,                               // currentFrame
-            false,                           // isAnimated
-            false                            // isMoving
-        };
-        
-        // Add to containers
-        gameSprites.insert(sprite);
-        static_textures.push_back(texture);
-        static_texture_rects.insert({0, 0, surface->w, surface->h});
-        SDL_FreeSurface(surface);
+    // Call fn for every entry whose foot center cell could reach area; the
+    // caller does the exact test
+    template <typename Fn>
+    void forEachCandidate(const SDL_Rect& area, Fn&& fn) const {
+        if (entries.empty()) return;
+        int x0 = cellOf(area.x - maxHalfW, cellSize);
+        int y0 = cellOf(area.y - maxHalfH, cellSize);
+        int x1 = cellOf(area.x + area.w + maxHalfW, cellSize);
+        int y1 = cellOf(area.y + area.h + maxHalfH, cellSize);
+        if (static_cast<size_t>(x1 - x0 + 1) * (y1 - y0 + 1) > tableMask + 1) {
+            // Huge area: scanning everything is cheaper than visiting cells
+            for (const Entry& e : entries) {
+                if (e.cellX >= x0 && e.cellX <= x1 && e.cellY >= y0 && e.cellY <= y1) fn(e);
+            }
+            return;
+        }
+        for (int cy = y0; cy <= y1; cy++) {
+            for (int cx = x0; cx <= x1; cx++) {
+                size_t b = bucketOf(cx, cy);
+                for (Uint32 i = bucketStart[b]; i < bucketStart[b + 1]; i++) {
+                    // Buckets are shared by colliding cells; report each entry from its own cell only
+                    if (entries[i].cellX == cx && entries[i].cellY == cy) fn(entries[i]);
+                }
+            }
+        }
     }
-}
 
-// Load a game level
-bool loadLevel(std::string levelName) {
-    // Clear previous level data
-    for (auto& texture : static_textures) {
-        SDL_DestroyTexture(texture);
+    // Entities whose foot rectangle intersects area
+    void queryRect(const SDL_Rect& area, std::vector<EntityId>& out) const {
+        out.clear();
+        forEachCandidate(area, [&](const Entry& e) {
+            if (SDL_HasIntersection(&e.foot, &area)) out.push_back(e.id);
+        });
     }
-    static_textures.clear();
-    static_texture_rects.clear();
-    gameSprites.clear();
-    
-    // Build level path and load map
-    std::string levelPath = "assets/levels/" + levelName + ".txt";
-    return loadMapFile(levelPath);
-}
 
-// Process input events and update game state
-bool handleEvents() {
-    // Find player sprite
-    auto playerSprite = std::find_if(gameSprites.begin(), gameSprites.end(),
-        [](const GameSprite& sprite) { return sprite.spriteName == "aaron"; });
+    // Entities whose foot center lies within radius of a point
+    void queryRadius(float x, float y, float radius, std::vector<EntityId>& out) const {
+        out.clear();
+        SDL_Rect area = {static_cast<int>(std::floor(x - radius)), static_cast<int>(std::floor(y - radius)),
+                         static_cast<int>(std::ceil(radius * 2)) + 1, static_cast<int>(std::ceil(radius * 2)) + 1};
+        forEachCandidate(area, [&](const Entry& e) {
+            float dx = e.foot.x + e.foot.w / 2.0f - x;
+            float dy = e.foot.y + e.foot.h / 2.0f - y;
+            if (dx * dx + dy * dy <= radius * radius) out.push_back(e.id);
+        });
+    }
 
-    if (playerSprite == gameSprites.end()) {
-        return true; // Continue if player not found
+    // True when a foot rectangle moving from one place to another would
+    // enter a static prop it did not already overlap
+    bool blocked(const SDL_Rect& from, const SDL_Rect& to) const {
+        bool hit = false;
+        forEachCandidate(to, [&](const Entry& e) {
+            if (!hit && e.isStatic && SDL_HasIntersection(&e.foot, &to) && !SDL_HasIntersection(&e.foot, &from)) hit = true;
+        });
+        return hit;
     }
+};
 
-    // Create modifiable copy of player sprite
-    GameSprite updatedSprite = *playerSprite;
-    bool needsUpdate = false;
+// Game object containers
+std::vector<GameSprite> gameSprites;  // Entity store, indexed by EntityId (updated in place)
+std::vector<EntityId> freeEntities;   // Despawned slots reused by spawnSprite()
+std::vector<EntityId> drawOrder;      // Visible entity IDs in depth order, rebuilt before each render
+std::vector<EntityId> visibleScratch; // Reused buffer for spatial queries
+std::vector<Uint32> drawMarks;        // Per-entity stamp used when rebuilding drawOrder
+Uint32 drawStamp = 0;
+const int GRID_CELL_SIZE = 64;        // Spatial grid cell size in world units
+SpatialGrid spatialGrid(MAP_WIDTH, MAP_HEIGHT, GRID_CELL_SIZE);
+const int FOOT_HASH_CELL_SIZE = 32;   // Foot-rect broadphase cell size in world units
+SpatialHash footHash;                 // Foot rectangles, rebuilt at the start of every tick
+EntityId playerId = INVALID_ENTITY;   // Player entity, assigned when loadMapFile() spawns "aaron"
+SDL_FPoint backgroundOffset = {0.0f, 0.0f};  // Camera offset (sub-pixel)
+SDL_Rect playerRect;                // Player position (deprecated)
+SDL_Rect backgroundRect;            // Background position (deprecated)
 
-    // Calculate frame timing
-    Uint64 currentTime = SDL_GetPerformanceCounter();
-    deltaTime = (double)((currentTime - lastFrameTime) * 1000 / (double)SDL_GetPerformanceFrequency()) * 0.001;
-    lastFrameTime = currentTime;
+// Sounds the simulation triggers during a frame, at world positions. They
+// are recorded into the frame with a gain and pan relative to the camera and
+// played by the main thread; see AudioSystem.
+struct SoundEvent {
+    int sound;           // AudioSystem sound index
+    SDL_FPoint pos;      // World position
+};
+const size_t MAX_FRAME_SOUNDS = 64;     // Further sounds of a frame are dropped
+std::vector<SoundEvent> pendingSounds;  // Written by the simulation, reserved when audio starts
+std::vector<int> kindSounds;            // NameId -> sound played when the kind's animation loops, or -1
+int footstepSound = -1;                 // Player walking, on every other walk frame
 
-    // Process keyboard state
-    const Uint8* state = SDL_GetKeyboardState(NULL);
-    SDL_ShowCursor(SDL_DISABLE);  // Hide system cursor
+// A frame's sound as the main thread plays it
+struct SoundCommand {
+    int sound;
+    float gain;          // 0 to 1, from the distance to the camera center
+    float pan;           // -1 (left) to 1 (right)
+};
 
-    // Exit on ESC key
-    if(state[SDL_SCANCODE_ESCAPE]) {
-        return false;
-    }
+void queueSound(int sound, float x, float y) {
+    if (sound < 0 || pendingSounds.size() >= MAX_FRAME_SOUNDS) return;
+    pendingSounds.push_back({sound, {x, y}});
+}
 
-    // Calculate movement based on keyboard input
-    float moveAmount = PLAYER_SPEED * deltaTime;
-    int moveX = 0, moveY = 0;
-    bool isMoving = false;
+// Asset storage
+std::unordered_map<std::string, AtlasRegion> textureMap;   // Level textures by name
+const int ATLAS_PAGE_SIZE = 2048;                          // Maximum atlas page edge in pixels
+const int ATLAS_PADDING = 1;                               // Transparent gap between packed images
+std::vector<animation> animations;                         // Animation data, indexed by AnimId
+std::unordered_map<std::string, AnimId> animationMap;      // Animation name -> AnimId, rebuilt per level
+std::unordered_map<std::string, SDL_Point> textureFootMap; // Foot dimensions
 
-    // Process movement keys
-    if (state[SDL_SCANCODE_A]) {  // Left
-        moveX -= static_cast<int>(std::round(moveAmount));
+// Downscaled copies of atlas pages for zoomed-out views: level l is the page
+// at 1/2^l of its size, drawn when sprites cover about that many times fewer
+// pixels than they have. Images are packed at multiples of MIP_ALIGN, so
+// every 2x2 block filtered into a level lies within one image and its
+// padding, and no level mixes neighbouring images.
+const int TEXTURE_MIP_LEVELS = 4;                         // Full size plus three halvings
+const int MIP_ALIGN = 1 << (TEXTURE_MIP_LEVELS - 1);      // Image placement granularity on a page
+bool textureMipsEnabled = true;                           // --no-mipmaps disables the levels
+bool lazyAnimationsEnabled = true;                        // --eager-animations loads every frame with the level
+
+struct TextureMips {
+    SDL_Texture* levels[TEXTURE_MIP_LEVELS] = {};  // levels[0] is the page itself
+    int w[TEXTURE_MIP_LEVELS] = {}, h[TEXTURE_MIP_LEVELS] = {};
+    int count = 1;                                 // Levels created
+};
+std::unordered_map<SDL_Texture*, TextureMips> textureMips;  // By page (level 0)
+
+// Create the downscaled levels of an uploaded page from its RGBA32 pixels.
+// Colors are averaged weighted by alpha, so transparent texels do not darken
+// edges. Levels use linear filtering for smooth minification; the page
+// itself keeps the default scale mode for crisp magnification.
+void createTextureMips(SDL_Texture* page, const Uint8* pixels, int w, int h, int pitch) {
+    if (!textureMipsEnabled || !page) return;
+    TextureMips mips;
+    mips.levels[0] = page;
+    mips.w[0] = w;
+    mips.h[0] = h;
+
+    std::string previousQuality = SDL_GetHint(SDL_HINT_RENDER_SCALE_QUALITY) ? SDL_GetHint(SDL_HINT_RENDER_SCALE_QUALITY) : "";
+    SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "linear");
+    std::vector<Uint8> source(pixels, pixels + size_t(pitch) * h), level;
+    int sourcePitch = pitch;
+    for (int l = 1; l < TEXTURE_MIP_LEVELS && (w > 1 || h > 1); l++) {
+        int lw = std::max(1, (w + 1) / 2), lh = std::max(1, (h + 1) / 2);
+        level.assign(size_t(lw) * lh * 4, 0);
+        for (int y = 0; y < lh; y++) {
+            for (int x = 0; x < lw; x++) {
+                Uint32 sum[4] = {0, 0, 0, 0};
+                Uint32 texels = 0;
+                for (int sy = y * 2; sy < std::min(h, y * 2 + 2); sy++) {
+                    for (int sx = x * 2; sx < std::min(w, x * 2 + 2); sx++) {
+                        const Uint8* texel = &source[size_t(sy) * sourcePitch + sx * 4];
+                        for (int c = 0; c < 3; c++) sum[c] += texel[c] * texel[3];
+                        sum[3] += texel[3];
+                        texels++;
+                    }
+                }
+                Uint8* out = &level[(size_t(y) * lw + x) * 4];
+                for (int c = 0; c < 3; c++) out[c] = static_cast<Uint8>(sum[3] ? sum[c] / sum[3] : 0);
+                out[3] = static_cast<Uint8>(sum[3] / texels);
+            }
+        }
+        SDL_Texture* texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA32, SDL_TEXTUREACCESS_STATIC, lw, lh);
+        if (!texture) {
+            LOG(LOG_WARN, "Failed to create texture mip level: " << SDL_GetError());
+            break;
+        }
+        SDL_UpdateTexture(texture, nullptr, level.data(), lw * 4);
+        SDL_SetTextureBlendMode(texture, SDL_BLENDMODE_BLEND);
+        mips.levels[l] = texture;
+        mips.w[l] = lw;
+        mips.h[l] = lh;
+        mips.count = l + 1;
+        source.swap(level);
+        sourcePitch = lw * 4;
+        w = lw;
+        h = lh;
+    }
+    SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, previousQuality.c_str());
+    if (mips.count > 1) textureMips[page] = mips;
+}
+
+// VRAM used by a page and its levels
+size_t atlasPageBytes(SDL_Texture* page) {
+    auto it = textureMips.find(page);
+    if (it == textureMips.end()) {
+        int w = 0, h = 0;
+        SDL_QueryTexture(page, nullptr, nullptr, &w, &h);
+        return size_t(w) * h * 4;
+    }
+    size_t bytes = 0;
+    for (int l = 0; l < it->second.count; l++) bytes += size_t(it->second.w[l]) * it->second.h[l] * 4;
+    return bytes;
+}
+
+// Destroy a page together with its levels
+void destroyAtlasPage(SDL_Texture* page) {
+    auto it = textureMips.find(page);
+    if (it != textureMips.end()) {
+        for (int l = 1; l < it->second.count; l++) SDL_DestroyTexture(it->second.levels[l]);
+        textureMips.erase(it);
+    }
+    SDL_DestroyTexture(page);
+}
+
+// Nearest level for drawing at a view scale: about one texel per pixel
+int mipLevelFor(float scale) {
+    if (!textureMipsEnabled || scale >= 1.0f) return 0;
+    int level = static_cast<int>(std::lround(std::log2(1.0f / scale)));
+    return std::clamp(level, 0, TEXTURE_MIP_LEVELS - 1);
+}
+
+// The same image on a level of its page. The pixel rect is rounded out to
+// whole level texels; the coordinates stay exact, so images keep their
+// size on screen.
+AtlasRegion mipRegion(const AtlasRegion& image, const TextureMips& mips, int level) {
+    level = std::min(level, mips.count - 1);
+    if (level <= 0) return image;
+    AtlasRegion r;
+    r.page = mips.levels[level];
+    int step = 1 << level;
+    r.src.x = image.src.x >> level;
+    r.src.y = image.src.y >> level;
+    r.src.w = ((image.src.x + image.src.w + step - 1) >> level) - r.src.x;
+    r.src.h = ((image.src.y + image.src.h + step - 1) >> level) - r.src.y;
+    float pageW = static_cast<float>(mips.w[level] * step), pageH = static_cast<float>(mips.h[level] * step);
+    r.u0 = image.src.x / pageW;
+    r.v0 = image.src.y / pageH;
+    r.u1 = (image.src.x + image.src.w) / pageW;
+    r.v1 = (image.src.y + image.src.h) / pageH;
+    return r;
+}
+
+// Reference-counted cache of level textures and animations shared across
+// level loads. Assets live on shared atlas pages, so a page's VRAM is only
+// released once every asset on it is unreferenced; unreferenced pages stay
+// resident until the VRAM budget forces them out, least recently used first.
+struct AssetCache {
+    struct Page {
+        SDL_Texture* texture = nullptr;  // Null once evicted
+        size_t bytes = 0;
+    };
+    struct Asset {
+        std::string name;                  // Texture or animation name
+        bool isAnimation = false;
+        std::vector<AtlasRegion> regions;  // Texture image or animation frames
+        std::vector<int> pages;            // Pages holding the regions
+        int refCount = 0;
+        Uint64 lastUsed = 0;
+        bool resident = false;
+    };
+
+    std::vector<Page> pages;
+    std::vector<Asset> assets;
+    std::unordered_map<std::string, int> lookup;  // Asset key (source path) -> asset index
+    std::vector<int> retiredPages;                // Pages left holding only reloaded-over regions
+    size_t residentBytes = 0;
+    size_t budgetBytes = size_t(256) << 20;       // --vram-budget=<MB>
+    Uint64 useClock = 0;
+
+    bool isResident(const std::string& key) const {
+        auto it = lookup.find(key);
+        return it != lookup.end() && assets[it->second].resident;
+    }
+
+    // Take ownership of an uploaded atlas page
+    void addPage(SDL_Texture* texture) {
+        pages.push_back({texture, atlasPageBytes(texture)});
+        residentBytes += pages.back().bytes;
+    }
+
+    // Reference a resident asset; returns -1 when it must be loaded
+    int acquire(const std::string& key) {
+        auto it = lookup.find(key);
+        if (it == lookup.end() || !assets[it->second].resident) return -1;
+        Asset& asset = assets[it->second];
+        asset.refCount++;
+        asset.lastUsed = ++useClock;
+        return it->second;
+    }
+
+    // Register a newly loaded asset whose regions are on added pages, already referenced once
+    int add(const std::string& key, const std::string& name, bool isAnimation, const std::vector<AtlasRegion>& regions) {
+        auto it = lookup.find(key);
+        int index = it != lookup.end() ? it->second : static_cast<int>(assets.size());
+        if (it == lookup.end()) {
+            lookup[key] = index;
+            assets.emplace_back();
+        }
+        Asset& asset = assets[index];
+        std::vector<int> previousPages;
+        previousPages.swap(asset.pages);
+        asset = Asset();
+        asset.name = name;
+        asset.isAnimation = isAnimation;
+        asset.regions = regions;
+        asset.refCount = 1;
+        asset.lastUsed = ++useClock;
+        asset.resident = true;
+        for (const AtlasRegion& region : regions) {
+            for (int p = static_cast<int>(pages.size()) - 1; p >= 0; p--) {
+                if (region.page && pages[p].texture == region.page) {
+                    if (std::find(asset.pages.begin(), asset.pages.end(), p) == asset.pages.end()) asset.pages.push_back(p);
+                    break;
+                }
+            }
+        }
+
+        // A reload supersedes the old regions; frames in flight may still
+        // draw them, so pages no asset owns any more are freed at the next
+        // level load rather than now
+        for (int p : previousPages) {
+            if (!isPageOwned(p)) retiredPages.push_back(p);
+        }
+        return index;
+    }
+
+    bool isPageOwned(int p) const {
+        return std::any_of(assets.begin(), assets.end(), [&](const Asset& asset) {
+            return asset.resident && std::find(asset.pages.begin(), asset.pages.end(), p) != asset.pages.end();
+        });
+    }
+
+    // Free the pages superseded by reloads (between levels, when no frame
+    // can draw them)
+    void releaseRetired() {
+        for (int p : retiredPages) {
+            if (pages[p].texture && !isPageOwned(p)) evictPage(p);
+        }
+        retiredPages.clear();
+    }
+
+    void release(int index) {
+        if (index >= 0 && assets[index].refCount > 0) assets[index].refCount--;
+    }
+
+    // Evict unreferenced pages, least recently used first, until resident
+    // VRAM fits the budget
+    void trim() {
+        while (residentBytes > budgetBytes) {
+            // A page is evictable when no referenced asset lives on it
+            std::vector<Uint64> pageLastUsed(pages.size(), 0);
+            std::vector<char> pinned(pages.size(), 0);
+            for (const Asset& asset : assets) {
+                if (!asset.resident) continue;
+                for (int p : asset.pages) {
+                    pageLastUsed[p] = std::max(pageLastUsed[p], asset.lastUsed);
+                    if (asset.refCount > 0) pinned[p] = 1;
+                }
+            }
+            int victim = -1;
+            for (size_t p = 0; p < pages.size(); p++) {
+                if (!pages[p].texture || pinned[p]) continue;
+                if (victim < 0 || pageLastUsed[p] < pageLastUsed[victim]) victim = static_cast<int>(p);
+            }
+            if (victim < 0) break;  // Everything left is in use
+            evictPage(victim);
+        }
+    }
+
+    // Free a page and drop every asset that had regions on it
+    void evictPage(int p) {
+        for (Asset& asset : assets) {
+            if (!asset.resident || std::find(asset.pages.begin(), asset.pages.end(), p) == asset.pages.end()) continue;
+            forget(asset);
+            asset.resident = false;
+            asset.regions.clear();
+            asset.pages.clear();
+        }
+        destroyAtlasPage(pages[p].texture);
+        residentBytes -= pages[p].bytes;
+        pages[p] = Page();
+    }
+
+    // Remove name lookups that still point at an evicted asset
+    void forget(const Asset& asset) {
+        SDL_Texture* page = asset.regions.empty() ? nullptr : asset.regions.front().page;
+        if (asset.isAnimation) {
+            auto animIt = animationMap.find(asset.name);
+            if (animIt != animationMap.end()) {
+                animation& anim = animations[animIt->second];
+                if (!anim.frames.empty() && anim.frames.front().page == page) anim.frames.clear();
+            }
+        } else {
+            auto texIt = textureMap.find(asset.name);
+            if (texIt != textureMap.end() && texIt->second.page == page) textureMap.erase(texIt);
+        }
+    }
+
+    // Destroy every page
+    void clear() {
+        for (Page& page : pages) {
+            if (page.texture) destroyAtlasPage(page.texture);
+        }
+        pages.clear();
+        assets.clear();
+        lookup.clear();
+        retiredPages.clear();
+        residentBytes = 0;
+    }
+};
+
+AssetCache assetCache;
+std::vector<int> levelAssets;  // Cache entries referenced by the current level
+
+// Performance tracking
+double currentFPS = 0.0;                     // Current FPS value
+const size_t FPS_HISTORY_SIZE = 60;           // History buffer size
+double fpsHistory[FPS_HISTORY_SIZE];          // FPS ring buffer
+size_t fpsSamples = 0;                        // FPS values recorded so far
+
+// Heap allocations made by the frame threads (main and simulation), counted
+// by the global operator new. Background threads (logger, streaming,
+// loaders, audio) are not counted, so their work never shows up in a frame.
+thread_local bool countHeapAllocations = false;
+std::atomic<Uint64> heapAllocations{0};
+
+// The replacements stay out of line: inlined into a caller, GCC would see
+// malloc() paired with operator delete and free() with operator new, and
+// warn that they are mismatched
+#if defined(__GNUC__) || defined(__clang__)
+#define ALLOCATOR_NOINLINE __attribute__((noinline))
+#elif defined(_MSC_VER)
+#define ALLOCATOR_NOINLINE __declspec(noinline)
+#else
+#define ALLOCATOR_NOINLINE
+#endif
+ALLOCATOR_NOINLINE void* operator new(std::size_t size) {
+    if (countHeapAllocations) heapAllocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+ALLOCATOR_NOINLINE void operator delete(void* p) noexcept { std::free(p); }
+ALLOCATOR_NOINLINE void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+
+// Bump allocator for data that only lives for one frame. reset() recycles
+// everything at once; a frame that outgrows the block is served from extra
+// blocks, which the next reset merges into one larger block, so after warm-up
+// frames never touch the heap. Only for trivially destructible types, and
+// each arena belongs to one thread.
+struct FrameArena {
+    std::unique_ptr<char[]> block;
+    size_t capacity = 0;
+    size_t used = 0;
+    std::vector<std::unique_ptr<char[]>> overflow;  // Extra blocks of this frame
+    size_t overflowBytes = 0;
+
+    explicit FrameArena(size_t initialBytes) : block(new char[initialBytes]), capacity(initialBytes) {}
+
+    void* allocate(size_t bytes, size_t align) {
+        size_t offset = (used + align - 1) & ~(align - 1);
+        if (offset + bytes <= capacity) {
+            used = offset + bytes;
+            return block.get() + offset;
+        }
+        overflow.emplace_back(new char[bytes + align]);
+        overflowBytes += bytes + align;
+        uintptr_t p = reinterpret_cast<uintptr_t>(overflow.back().get());
+        return reinterpret_cast<void*>((p + align - 1) & ~(uintptr_t(align) - 1));
+    }
+
+    // Uninitialized array of n elements, valid until the next reset
+    template <typename T>
+    T* allocArray(size_t n) {
+        static_assert(std::is_trivially_destructible<T>::value, "arena memory is never destroyed");
+        return static_cast<T*>(allocate(n * sizeof(T), alignof(T)));
+    }
+
+    void reset() {
+        if (!overflow.empty()) {
+            capacity = std::max(capacity * 2, used + overflowBytes);
+            block.reset(new char[capacity]);
+            overflow.clear();
+            overflowBytes = 0;
+        }
+        used = 0;
+    }
+};
+
+FrameArena simulationArena(64 << 10);  // Reset by simulateFrame, on the simulation thread
+FrameArena renderArena(64 << 10);      // Reset by render, on the main thread
+
+// Steady-state allocation check (--check-allocations). After a warm-up, a
+// frame that made heap allocations is reported, and asserts in debug builds,
+// unless something allowed to allocate happened during it: spawning,
+// streaming, layer rebuilds, loading. Pooled containers growing past their
+// warm-up capacity show up here too, which is the point.
+struct AllocationCheck {
+    bool enabled = false;
+    int warmupFrames = 120;
+    int frames = 0;
+    std::atomic<bool> exempt{false};  // Set from either frame thread for the current frame
+
+    void exemptFrame() { exempt.store(true, std::memory_order_relaxed); }
+
+    // Called once per frame with the allocations the frame made
+    void endFrame(Uint64 allocations) {
+        bool skip = exempt.exchange(false, std::memory_order_relaxed);
+        if (!enabled || ++frames <= warmupFrames || skip || allocations == 0) return;
+        LOG_RATE_LIMITED(LOG_ERROR, "Frame " << frames << " made " << allocations
+                                        << " heap allocations in steady state");
+        assert(allocations == 0 && "heap allocation in a steady-state frame");
+    }
+};
+
+AllocationCheck allocationCheck;
+
+// Profiled phases of a frame, and per-frame counters
+enum ProfileZone {
+    ZONE_INPUT, ZONE_SIMULATE, ZONE_PLAYER, ZONE_NPCS, ZONE_STREAMING, ZONE_SORT, ZONE_RECORD,
+    ZONE_LAYERS, ZONE_SPRITES, ZONE_TEXT, ZONE_PRESENT, ZONE_SIM_WAIT, ZONE_AUDIO, ZONE_COUNT
+};
+const char* const zoneNames[ZONE_COUNT] = {
+    "input", "simulate", "player", "npcs", "streaming", "sort", "record",
+    "layers", "sprites", "text", "present", "sim wait", "audio"
+};
+enum ProfileCounter { COUNTER_DRAW_CALLS, COUNTER_TEXTURE_SWITCHES, COUNTER_ENTITIES_UPDATED, COUNTER_COUNT };
+const char* const counterNames[COUNTER_COUNT] = {"draw calls", "texture switches", "entities updated"};
+
+// Frame profiler. Each thread that records zones gets its own slot with a
+// ring buffer of trace events and per-frame totals, so recording takes no
+// locks. endFrame() folds the slots into the frame history and must run
+// while no other thread is recording, i.e. between frames.
+struct FrameProfiler {
+    static constexpr int MAX_THREADS = 4;
+    static constexpr size_t TRACE_CAPACITY = 1 << 15;  // Trace events kept per thread
+    static constexpr size_t HISTORY_SIZE = 600;        // Frames kept for statistics
+
+    struct TraceEvent {
+        Uint64 begin, end;   // Performance counter ticks
+        int zone;
+    };
+    struct ThreadSlot {
+        std::vector<TraceEvent> events;  // Ring buffer, TRACE_CAPACITY entries once started
+        size_t written = 0;              // Events ever written
+        Uint64 zoneTicks[ZONE_COUNT] = {};
+        Uint64 counters[COUNTER_COUNT] = {};
+    };
+    struct FrameStats {
+        double frameMs = 0.0;
+        double zoneMs[ZONE_COUNT] = {};
+        Uint64 counters[COUNTER_COUNT] = {};
+        Uint64 allocations = 0;
+    };
+
+    ThreadSlot slots[MAX_THREADS];
+    std::atomic<int> threadCount{0};
+    std::vector<FrameStats> history = std::vector<FrameStats>(HISTORY_SIZE);
+    size_t frames = 0;               // Frames ever ended
+    Uint64 origin = SDL_GetPerformanceCounter();
+    Uint64 frameStart = origin;
+    Uint64 allocationsAtFrameStart = 0;
+    std::vector<double> scratch;     // Sorting buffer for percentiles
+    bool overlayVisible = false;     // Toggled with F3
+
+    // Slot of the calling thread, or null once MAX_THREADS are registered
+    ThreadSlot* threadSlot() {
+        static thread_local int index = -1;
+        if (index < 0) {
+            index = threadCount.fetch_add(1);
+            if (index < MAX_THREADS) slots[index].events.resize(TRACE_CAPACITY);
+        }
+        return index < MAX_THREADS ? &slots[index] : nullptr;
+    }
+
+    void record(int zone, Uint64 begin, Uint64 end) {
+        ThreadSlot* slot = threadSlot();
+        if (!slot) return;
+        slot->events[slot->written++ % TRACE_CAPACITY] = {begin, end, zone};
+        slot->zoneTicks[zone] += end - begin;
+    }
+
+    void count(int counter, Uint64 n = 1) {
+        if (ThreadSlot* slot = threadSlot()) slot->counters[counter] += n;
+    }
+
+    // Close the current frame and start the next one
+    void endFrame() {
+        Uint64 now = SDL_GetPerformanceCounter();
+        double msPerTick = 1000.0 / SDL_GetPerformanceFrequency();
+        FrameStats& stats = history[frames++ % HISTORY_SIZE];
+        stats = FrameStats();
+        stats.frameMs = (now - frameStart) * msPerTick;
+        int used = std::min(threadCount.load(), MAX_THREADS);
+        for (int t = 0; t < used; t++) {
+            ThreadSlot& slot = slots[t];
+            for (int z = 0; z < ZONE_COUNT; z++) stats.zoneMs[z] += slot.zoneTicks[z] * msPerTick;
+            for (int c = 0; c < COUNTER_COUNT; c++) stats.counters[c] += slot.counters[c];
+            std::fill(std::begin(slot.zoneTicks), std::end(slot.zoneTicks), 0);
+            std::fill(std::begin(slot.counters), std::end(slot.counters), 0);
+        }
+        Uint64 allocations = heapAllocations.load(std::memory_order_relaxed);
+        stats.allocations = allocations - allocationsAtFrameStart;
+        allocationsAtFrameStart = allocations;
+        frameStart = now;
+    }
+
+    size_t historyCount() const { return std::min(frames, HISTORY_SIZE); }
+
+    // The i-th most recent recorded frame (0 is the last one)
+    const FrameStats& recent(size_t i) const { return history[(frames - 1 - i) % HISTORY_SIZE]; }
+
+    // Min, average and 99th percentile of a value over the frame history
+    template <typename Fn>
+    void summarize(const Fn& value, double& min, double& avg, double& p99) {
+        size_t n = historyCount();
+        min = avg = p99 = 0.0;
+        if (n == 0) return;
+        scratch.clear();
+        scratch.reserve(HISTORY_SIZE);
+        for (size_t i = 0; i < n; i++) scratch.push_back(value(history[i]));
+        size_t rank = std::min(n - 1, static_cast<size_t>(std::ceil(n * 0.99)) - 1);
+        std::nth_element(scratch.begin(), scratch.begin() + rank, scratch.end());
+        p99 = scratch[rank];
+        min = *std::min_element(scratch.begin(), scratch.end());
+        for (double v : scratch) avg += v;
+        avg /= n;
+    }
+
+    // Write the buffered events as Chrome trace JSON (chrome://tracing, Perfetto)
+    bool dumpTrace(const std::string& path) {
+        std::ofstream out(path);
+        if (!out) {
+            LOG(LOG_ERROR, "Failed to write profile trace: " << path);
+            return false;
+        }
+        double usPerTick = 1e6 / SDL_GetPerformanceFrequency();
+        out << "{\"traceEvents\":[\n";
+        bool first = true;
+        size_t total = 0;
+        int used = std::min(threadCount.load(), MAX_THREADS);
+        for (int t = 0; t < used; t++) {
+            const ThreadSlot& slot = slots[t];
+            size_t count = std::min(slot.written, TRACE_CAPACITY);
+            for (size_t i = slot.written - count; i < slot.written; i++) {
+                const TraceEvent& e = slot.events[i % TRACE_CAPACITY];
+                out << (first ? "" : ",\n") << "{\"name\":\"" << zoneNames[e.zone]
+                    << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << t
+                    << ",\"ts\":" << (e.begin - origin) * usPerTick
+                    << ",\"dur\":" << (e.end - e.begin) * usPerTick << "}";
+                first = false;
+            }
+            total += count;
+        }
+        out << "\n]}\n";
+        LOG(LOG_INFO, "Wrote " << total << " profile events to " << path);
+        return true;
+    }
+};
+
+FrameProfiler profiler;
+std::string profileTracePath;  // --profile-trace=<file> dumps the trace at exit
+
+// Times the enclosing scope as one profiler zone
+struct ProfileScope {
+    int zone;
+    Uint64 begin;
+    explicit ProfileScope(int z) : zone(z), begin(SDL_GetPerformanceCounter()) {}
+    ~ProfileScope() { profiler.record(zone, begin, SDL_GetPerformanceCounter()); }
+};
+
+// Mouse cursor
+GameSprite* cursor = nullptr;  // Custom cursor sprite
+
+// Facing directions
+enum class PlayerFacing { N, S, NE, SE, NW, SW };
+static PlayerFacing   g_playerFacing = PlayerFacing::S;
+static char           g_lastVertical = 'S';  // 'N' or 'S'
+
+// Player animations indexed by [isMoving][PlayerFacing], resolved in loadMapFile()
+static AnimId         g_playerAnims[2][6];
+static const char*    g_playerAnimNames[2][6] = {
+    { "aaronIdleN", "aaronIdleS", "aaronIdleNE", "aaronIdleSE", "aaronIdleNE", "aaronIdleSE" },
+    { "aaronWalkN", "aaronWalkS", "aaronWalkNE", "aaronWalkSE", "aaronWalkNE", "aaronWalkSE" }
+};
+
+// Region covering an entire standalone texture
+AtlasRegion wholeTexture(SDL_Texture* texture) {
+    AtlasRegion region;
+    region.page = texture;
+    SDL_QueryTexture(texture, nullptr, nullptr, &region.src.w, &region.src.h);
+    return region;
+}
+
+// Atlas layout computed on the CPU: composed RGBA32 page surfaces and the
+// placement of each input image. Images larger than a page get a page of
+// their own.
+struct PackedAtlas {
+    struct Slot { int page = -1; SDL_Rect src = {0, 0, 0, 0}; };
+    std::vector<SDL_Surface*> pages;  // Null where a page could not be created
+    std::vector<Slot> slots;          // Placement of each image, in input order
+};
+
+// Pack images into as few atlas pages as possible using shelf packing. The
+// input surfaces are freed.
+PackedAtlas packAtlas(std::vector<SDL_Surface*>& images) {
+    PackedAtlas atlas;
+    atlas.slots.resize(images.size());
+
+    // Place tallest images first so shelves are filled tightly; missing
+    // images sort last and get no slot
+    std::vector<size_t> order(images.size());
+    for (size_t i = 0; i < order.size(); i++) order[i] = i;
+    std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        return images[a] && (!images[b] || images[a]->h > images[b]->h);
+    });
+
+    std::vector<SDL_Point> pageSizes;  // Used extent of each page
+    int shelfX = 0, shelfY = 0, shelfH = 0;
+
+    for (size_t i : order) {
+        SDL_Surface* img = images[i];
+        if (!img) continue;
+        int w = (img->w + ATLAS_PADDING + MIP_ALIGN - 1) / MIP_ALIGN * MIP_ALIGN;
+        int h = (img->h + ATLAS_PADDING + MIP_ALIGN - 1) / MIP_ALIGN * MIP_ALIGN;
+        if (w > ATLAS_PAGE_SIZE || h > ATLAS_PAGE_SIZE) continue;  // Standalone below
+
+        if (pageSizes.empty() || shelfX + w > ATLAS_PAGE_SIZE) {
+            // Start a new shelf, and a new page when the shelf does not fit
+            shelfY += shelfH;
+            shelfX = 0;
+            shelfH = 0;
+            if (pageSizes.empty() || shelfY + h > ATLAS_PAGE_SIZE) {
+                pageSizes.push_back({0, 0});
+                shelfY = 0;
+            }
+        }
+        atlas.slots[i] = {static_cast<int>(pageSizes.size()) - 1, {shelfX, shelfY, img->w, img->h}};
+        shelfX += w;
+        shelfH = std::max(shelfH, h);
+        SDL_Point& extent = pageSizes.back();
+        extent.x = std::max(extent.x, shelfX);
+        extent.y = std::max(extent.y, shelfY + shelfH);
+    }
+
+    // Compose each page
+    for (size_t p = 0; p < pageSizes.size(); p++) {
+        SDL_Surface* pageSurface = SDL_CreateRGBSurfaceWithFormat(0, pageSizes[p].x, pageSizes[p].y, 32, SDL_PIXELFORMAT_RGBA32);
+        if (!pageSurface) {
+            LOG(LOG_ERROR, "Failed to create atlas page: " << SDL_GetError());
+        } else {
+            for (size_t i = 0; i < images.size(); i++) {
+                if (atlas.slots[i].page != static_cast<int>(p)) continue;
+                SDL_Rect dst = atlas.slots[i].src;
+                SDL_SetSurfaceBlendMode(images[i], SDL_BLENDMODE_NONE);  // Copy alpha as-is
+                SDL_BlitSurface(images[i], nullptr, pageSurface, &dst);
+            }
+        }
+        atlas.pages.push_back(pageSurface);
+    }
+
+    // Oversized images keep a page of their own
+    for (size_t i = 0; i < images.size(); i++) {
+        if (images[i] && atlas.slots[i].page < 0) {
+            atlas.slots[i] = {static_cast<int>(atlas.pages.size()), {0, 0, images[i]->w, images[i]->h}};
+            atlas.pages.push_back(SDL_ConvertSurfaceFormat(images[i], SDL_PIXELFORMAT_RGBA32, 0));
+        }
+        SDL_FreeSurface(images[i]);
+    }
+    images.clear();
+    return atlas;
+}
+
+// Region of a rectangle within an uploaded atlas page
+AtlasRegion atlasRegion(SDL_Texture* page, const SDL_Rect& src, int pageW, int pageH) {
+    AtlasRegion r;
+    r.page = page;
+    r.src = src;
+    r.u0 = src.x / static_cast<float>(pageW);
+    r.v0 = src.y / static_cast<float>(pageH);
+    r.u1 = (src.x + src.w) / static_cast<float>(pageW);
+    r.v1 = (src.y + src.h) / static_cast<float>(pageH);
+    return r;
+}
+
+// Pack images into atlas pages, upload the pages (with their mip levels
+// unless disabled) and return the region of each image (in input order).
+// The input surfaces are freed.
+std::vector<AtlasRegion> buildAtlas(std::vector<SDL_Surface*>& images, std::vector<SDL_Texture*>& pages,
+                                    bool mipmapped = true) {
+    PackedAtlas atlas = packAtlas(images);
+    std::vector<AtlasRegion> regions(atlas.slots.size());
+
+    std::vector<SDL_Texture*> textures(atlas.pages.size(), nullptr);
+    for (size_t p = 0; p < atlas.pages.size(); p++) {
+        if (!atlas.pages[p]) continue;
+        SDL_Surface* surface = atlas.pages[p];
+        textures[p] = SDL_CreateTextureFromSurface(renderer, surface);
+        if (!textures[p]) {
+            LOG(LOG_ERROR, "Failed to create atlas page texture: " << SDL_GetError());
+        } else {
+            pages.push_back(textures[p]);
+            if (mipmapped && SDL_LockSurface(surface) == 0) {
+                createTextureMips(textures[p], static_cast<const Uint8*>(surface->pixels), surface->w, surface->h, surface->pitch);
+                SDL_UnlockSurface(surface);
+            }
+        }
+    }
+
+    for (size_t i = 0; i < atlas.slots.size(); i++) {
+        int p = atlas.slots[i].page;
+        if (p >= 0 && textures[p]) {
+            regions[i] = atlasRegion(textures[p], atlas.slots[i].src, atlas.pages[p]->w, atlas.pages[p]->h);
+        }
+    }
+    for (SDL_Surface* page : atlas.pages) SDL_FreeSurface(page);
+    return regions;
+}
+
+// Initialize SDL and create window/renderer
+bool initSDL() {
+    // Headless runs need no display or audio device
+    if (headlessMode) {
+        SDL_SetHint(SDL_HINT_VIDEODRIVER, "dummy");
+        SDL_SetHint(SDL_HINT_AUDIODRIVER, "dummy");
+    }
+
+    // Initialize all SDL subsystems
+    if (SDL_Init(SDL_INIT_EVERYTHING) < 0) {
+        LOG(LOG_ERROR, "SDL could not initialize! SDL_Error: " << SDL_GetError());
+        return false;
+    }
+
+    // Create game window
+    window = SDL_CreateWindow("Space Monkeys", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, 800, 600,
+                              headlessMode ? SDL_WINDOW_HIDDEN : SDL_WINDOW_SHOWN);
+    if (!window) {
+        LOG(LOG_ERROR, "Window could not be created! SDL_Error: " << SDL_GetError());
+        SDL_Quit();
+        return false;
+    }
+
+    // Create hardware-accelerated renderer with VSync
+    Uint32 rendererFlags = headlessMode ? SDL_RENDERER_SOFTWARE : vsyncEnabled ? SDL_RENDERER_PRESENTVSYNC : 0;
+    renderer = SDL_CreateRenderer(window, -1, rendererFlags);
+    if (!renderer) {
+        LOG(LOG_ERROR, "Renderer could not be created! SDL Error: " << SDL_GetError());
+        SDL_DestroyWindow(window);
+        SDL_Quit();
+        return false;
+    }
+    LOG(LOG_INFO, "Sprite renderer: " << (spriteBackend == SPRITE_BACKEND_COPY ? "copy" : "batched"));
+    if (staticLayersEnabled && !SDL_RenderTargetSupported(renderer)) {
+        LOG(LOG_WARN, "Render targets not supported; static layers disabled");
+        staticLayersEnabled = false;
+    }
+    SDL_RendererInfo rendererInfo;
+    if (SDL_GetRendererInfo(renderer, &rendererInfo) == 0) {
+        maxStaticLayerSize = std::min(rendererInfo.max_texture_width, rendererInfo.max_texture_height);
+    }
+
+    // Initialize image loading support (PNG & JPG)
+    if (IMG_Init(IMG_INIT_PNG | IMG_INIT_JPG) == 0) {
+        LOG(LOG_ERROR, "SDL_image could not initialize! SDL_image Error: " << IMG_GetError());
+        SDL_DestroyRenderer(renderer);
+        SDL_DestroyWindow(window);
+        SDL_Quit();
+        return false;
+    }
+
+    // Initialize audio mixer
+    if (Mix_OpenAudio(44100, MIX_DEFAULT_FORMAT, 2, 2048) < 0) {
+        LOG(LOG_ERROR, "SDL_mixer could not initialize! SDL_mixer Error: " << Mix_GetError());
+        IMG_Quit();
+        SDL_DestroyRenderer(renderer);
+        SDL_DestroyWindow(window);
+        SDL_Quit();
+        return false;
+    }
+
+    // Initialize font rendering
+    if (TTF_Init() == -1) {
+        LOG(LOG_ERROR, "SDL_ttf could not initialize! SDL_ttf Error: " << TTF_GetError());
+        Mix_CloseAudio();
+        IMG_Quit();
+        SDL_DestroyRenderer(renderer);
+        SDL_DestroyWindow(window);
+        SDL_Quit();
+        return false;
+    }
+
+    // Load main font
+    font = TTF_OpenFont("assets/fonts/arial.ttf", 16);
+    if (!font) {
+        LOG(LOG_ERROR, "Failed to load font! SDL_ttf Error: " << TTF_GetError());
+        // Proceed without font if loading fails
+    }
+
+    // Create custom cursor
+    SDL_Surface* cursorSurface = IMG_Load("assets/textures/cursor.png");
+    if (!cursorSurface) {
+        LOG(LOG_ERROR, "Failed to load cursor texture! SDL_image Error: " << IMG_GetError());
+        return false;
+    }
+
+    SDL_Texture* cursorTexture = SDL_CreateTextureFromSurface(renderer, cursorSurface);
+    if (!cursorTexture) {
+        LOG(LOG_ERROR, "Failed to create cursor texture! SDL Error: " << SDL_GetError());
+        SDL_FreeSurface(cursorSurface);
+        return false;
+    }
+
+    int w = cursorSurface->w;
+    int h = cursorSurface->h;
+    cursor = new GameSprite{{0, 0, w, h}, {0, 0, w, h}, w, h, wholeTexture(cursorTexture), kindCursor, 0, false, false};
+    SDL_FreeSurface(cursorSurface);
+    return true;
+}
+
+// Sprite batch geometry, reused every frame
+std::vector<SDL_Vertex> batchVertices;
+std::vector<int> batchIndices;
+
+// Append a textured quad for an atlas region; the flip swaps U coordinates
+// and the color tints the image
+void appendSpriteQuad(const AtlasRegion& image, const SDL_FRect& dst, bool flipX,
+                      SDL_Color color = {255, 255, 255, 255}) {
+    float left = dst.x, top = dst.y;
+    float right = left + dst.w, bottom = top + dst.h;
+    float u0 = flipX ? image.u1 : image.u0;
+    float u1 = flipX ? image.u0 : image.u1;
+
+    int base = static_cast<int>(batchVertices.size());
+    batchVertices.push_back({{left,  top},    color, {u0, image.v0}});
+    batchVertices.push_back({{right, top},    color, {u1, image.v0}});
+    batchVertices.push_back({{right, bottom}, color, {u1, image.v1}});
+    batchVertices.push_back({{left,  bottom}, color, {u0, image.v1}});
+    const int quad[6] = {0, 1, 2, 0, 2, 3};
+    for (int i : quad) batchIndices.push_back(base + i);
+}
+
+// Submit all queued quads for one atlas page in a single draw call
+void flushSpriteBatch(SDL_Texture* page) {
+    if (!batchIndices.empty() && page) {
+        SDL_RenderGeometry(renderer, page, batchVertices.data(), static_cast<int>(batchVertices.size()),
+                           batchIndices.data(), static_cast<int>(batchIndices.size()));
+        profiler.count(COUNTER_DRAW_CALLS);
+    }
+    batchVertices.clear();
+    batchIndices.clear();
+}
+
+// Printable ASCII glyphs of one font, rasterized once into atlas pages
+struct GlyphAtlas {
+    static const int FIRST_GLYPH = 32;   // ' '
+    static const int GLYPH_COUNT = 95;   // ' ' .. '~'
+
+    std::vector<SDL_Texture*> pages;     // Atlas pages owning the glyph images
+    AtlasRegion glyphs[GLYPH_COUNT];     // Image of each glyph (white, tinted at draw time)
+    int advances[GLYPH_COUNT] = {};      // Horizontal pen advance per glyph
+};
+
+// Glyph atlases keyed by font, built on first use
+std::unordered_map<TTF_Font*, GlyphAtlas> glyphAtlases;
+
+// Rasterize the printable ASCII range of a font into a glyph atlas
+GlyphAtlas& glyphAtlasFor(TTF_Font* textFont) {
+    auto it = glyphAtlases.find(textFont);
+    if (it != glyphAtlases.end()) return it->second;
+
+    GlyphAtlas& atlas = glyphAtlases[textFont];
+    const SDL_Color white = {255, 255, 255, 255};
+    std::vector<SDL_Surface*> images;
+    std::vector<int> glyphIndex(GlyphAtlas::GLYPH_COUNT, -1);
+    for (int i = 0; i < GlyphAtlas::GLYPH_COUNT; i++) {
+        Uint16 ch = static_cast<Uint16>(GlyphAtlas::FIRST_GLYPH + i);
+        int advance = 0;
+        if (TTF_GlyphMetrics(textFont, ch, nullptr, nullptr, nullptr, nullptr, &advance) == 0) {
+            atlas.advances[i] = advance;
+        }
+        SDL_Surface* surface = TTF_RenderGlyph_Blended(textFont, ch, white);
+        if (!surface) continue;  // e.g. space on some fonts; advance still applies
+        glyphIndex[i] = static_cast<int>(images.size());
+        images.push_back(surface);
+    }
+
+    std::vector<AtlasRegion> regions = buildAtlas(images, atlas.pages, false);  // Text is drawn unscaled
+    for (int i = 0; i < GlyphAtlas::GLYPH_COUNT; i++) {
+        if (glyphIndex[i] >= 0) atlas.glyphs[i] = regions[glyphIndex[i]];
+    }
+    return atlas;
+}
+
+// Render text to the screen as glyph quads from the font's glyph atlas
+void renderText(std::string_view text, SDL_Color color, int x, int y) {
+    if (!font) return; // Skip if no font loaded
+    
+    GlyphAtlas& atlas = glyphAtlasFor(font);
+    SDL_Texture* batchPage = nullptr;
+    int penX = x;
+    for (char c : text) {
+        int index = static_cast<unsigned char>(c) - GlyphAtlas::FIRST_GLYPH;
+        if (index < 0 || index >= GlyphAtlas::GLYPH_COUNT) index = '?' - GlyphAtlas::FIRST_GLYPH;
+
+        const AtlasRegion& glyph = atlas.glyphs[index];
+        if (glyph.page) {
+            if (glyph.page != batchPage) {
+                flushSpriteBatch(batchPage);
+                batchPage = glyph.page;
+                profiler.count(COUNTER_TEXTURE_SWITCHES);
+            }
+            SDL_FRect destRect = {static_cast<float>(penX), static_cast<float>(y),
+                                  static_cast<float>(glyph.src.w), static_cast<float>(glyph.src.h)};
+            appendSpriteQuad(glyph, destRect, false, color);
+        }
+        penX += atlas.advances[index];
+    }
+    flushSpriteBatch(batchPage);
+}
+
+// Add a sprite to the entity store and return its stable ID
+EntityId spawnSprite(const GameSprite& sprite) {
+    allocationCheck.exemptFrame();
+    // Every entity gets a state slot; the RNG seed only needs to differ per entity
+    NPCState state;
+    EntityId id;
+    if (!freeEntities.empty()) {
+        id = freeEntities.back();
+        freeEntities.pop_back();
+        state.rngState = (static_cast<Uint32>(id * 2654435761u) ^ simulationSeed) | 1u;
+        gameSprites[id] = sprite;
+        npcStates[id] = state;
+        drawMarks[id] = 0;
+    } else {
+        id = gameSprites.size();
+        state.rngState = (static_cast<Uint32>(id * 2654435761u) ^ simulationSeed) | 1u;
+        gameSprites.push_back(sprite);
+        npcStates.push_back(state);
+        drawMarks.push_back(0);
+    }
+    gameSprites[id].alive = true;
+    gameSprites[id].prevPos = {sprite.posX, sprite.posY};
+    spatialGrid.insert(id, sprite.rect);
+    if (isStaticSprite(sprite)) markStaticLayers(sprite.rect);
+    return id;
+}
+
+// Sprite position blended between the previous and current tick
+SDL_FPoint interpolatedPosition(const GameSprite& sprite) {
+    return {
+        sprite.prevPos.x + (sprite.posX - sprite.prevPos.x) * renderAlpha,
+        sprite.prevPos.y + (sprite.posY - sprite.prevPos.y) * renderAlpha
+    };
+}
+
+// World-space rectangle currently covered by the screen
+SDL_Rect cameraWorldRect() {
+    return {
+        static_cast<int>(std::floor(-backgroundOffset.x)),
+        static_cast<int>(std::floor(-backgroundOffset.y)),
+        static_cast<int>(std::ceil(SCREEN_WIDTH / globalScale)) + 1,
+        static_cast<int>(std::ceil(SCREEN_HEIGHT / globalScale)) + 1
+    };
+}
+
+// Rebuild drawOrder from the sprites intersecting the camera, then restore
+// depth order with an insertion sort. Sprites that stay visible keep last
+// frame's position, so the list is nearly sorted and this runs in ~O(n).
+void sortDrawOrder() {
+    SDL_Rect view = cameraWorldRect();
+    spatialGrid.query(view, gameSprites, visibleScratch);
+
+    if (++drawStamp == 0) {
+        std::fill(drawMarks.begin(), drawMarks.end(), 0);
+        drawStamp = 1;
+    }
+    for (EntityId id : visibleScratch) drawMarks[id] = drawStamp;
+
+    // Keep still-visible sprites in their previous order, then append new ones
+    size_t kept = 0;
+    for (EntityId id : drawOrder) {
+        if (id < drawMarks.size() && drawMarks[id] == drawStamp) {
+            drawOrder[kept++] = id;
+            drawMarks[id] = 0;
+        }
+    }
+    drawOrder.resize(kept);
+    for (EntityId id : visibleScratch) {
+        if (drawMarks[id] == drawStamp) drawOrder.push_back(id);
+    }
+
+    for (size_t i = 1; i < drawOrder.size(); i++) {
+        EntityId id = drawOrder[i];
+        const GameSprite& sprite = gameSprites[id];
+        size_t j = i;
+        while (j > 0 && sprite < gameSprites[drawOrder[j - 1]]) {
+            drawOrder[j] = drawOrder[j - 1];
+            j--;
+        }
+        drawOrder[j] = id;
+    }
+}
+
+// Remove a sprite from the world; its ID is reused by a later spawn
+void despawnSprite(EntityId id) {
+    allocationCheck.exemptFrame();
+    spatialGrid.unlink(id);
+    gameSprites[id].alive = false;
+    if (isStaticSprite(gameSprites[id])) markStaticLayers(gameSprites[id].rect);
+    freeEntities.push_back(id);
+}
+
+// World chunks: map objects are stored per CHUNK_SIZE tile and only spawned
+// (simulated and drawn) while their chunk is near the camera. Chunks in the
+// prefetch ring have their sprites built on a background thread; distant
+// chunks are compacted back to spawn records. Entities outside the active
+// area are frozen into the chunk they stand in.
+const int CHUNK_SIZE = 512;            // Chunk edge in world units
+const int CHUNK_ACTIVE_MARGIN = 1;     // Chunks beyond the camera view kept active
+const int CHUNK_PREFETCH_MARGIN = 2;   // Chunks beyond the view built ahead of time
+const int CHUNK_EVICT_MARGIN = 3;      // Chunks beyond this are compacted to records
+
+// Map object waiting to be built: a sprite template placed at a position
+struct ChunkRecord {
+    int templateId;  // Index into mapTemplates
+    SDL_Point pos;
+};
+
+// Built or frozen entity of an inactive chunk
+struct ChunkEntity {
+    GameSprite sprite;
+    NPCState state;
+    int templateId;
+};
+
+struct WorldChunk {
+    enum State { COLD, PREFETCHING, READY, ACTIVE };
+    std::atomic<int> state{COLD};       // PREFETCHING chunks belong to the streaming thread
+    std::vector<ChunkRecord> records;   // Not yet built
+    std::vector<ChunkEntity> entities;  // Built or frozen
+
+    // Static layer bookkeeping, simulation thread only
+    Uint32 layerVersion = 1;            // Bumped when a static sprite over the chunk spawns or despawns
+    Uint32 layerSent = 0;               // Version the render stage holds (0: none)
+    float layerSentScale = 0.0f;        // globalScale the held layer was composited at
+    bool layerListed = false;           // Layer was part of the last recorded frame
+};
+
+std::vector<GameSprite> mapTemplates;        // Per map object name and image, resolved at load
+std::vector<int> entityTemplates;            // Template per EntityId, -1 for persistent entities
+std::unique_ptr<WorldChunk[]> worldChunks;
+int chunkCols = 0, chunkRows = 0;
+
+// Chunk containing a world point, clamped to the world
+int chunkAt(int wx, int wy) {
+    int cx = std::clamp(wx / CHUNK_SIZE, 0, chunkCols - 1);
+    int cy = std::clamp(wy / CHUNK_SIZE, 0, chunkRows - 1);
+    return cy * chunkCols + cx;
+}
+
+// Chunk of a sprite, by the center of its foot rectangle
+int chunkOf(const GameSprite& sprite) {
+    return chunkAt(sprite.footRect.x + sprite.footRect.w / 2, sprite.footRect.y + sprite.footRect.h / 2);
+}
+
+// Mark the static layers of every chunk overlapping a world area as stale
+void markStaticLayers(const SDL_Rect& area) {
+    if (!worldChunks) return;
+    int x0 = std::clamp(area.x / CHUNK_SIZE, 0, chunkCols - 1);
+    int y0 = std::clamp(area.y / CHUNK_SIZE, 0, chunkRows - 1);
+    int x1 = std::clamp((area.x + area.w - 1) / CHUNK_SIZE, 0, chunkCols - 1);
+    int y1 = std::clamp((area.y + area.h - 1) / CHUNK_SIZE, 0, chunkRows - 1);
+    for (int y = y0; y <= y1; y++) {
+        for (int x = x0; x <= x1; x++) worldChunks[y * chunkCols + x].layerVersion++;
+    }
+}
+
+// Template sprite moved to a world position. Animated sprites get a phase
+// offset on the shared clock derived from the position, so copies of the
+// same decor do not animate in lockstep.
+GameSprite placeSprite(const GameSprite& tmpl, int x, int y) {
+    GameSprite sprite = tmpl;
+    sprite.posX = static_cast<float>(x);
+    sprite.posY = static_cast<float>(y);
+    sprite.syncRects();
+    if (sprite.currentAnim != INVALID_ANIM) {
+        Uint32 seed = ((static_cast<Uint32>(x) * 73856093u) ^ (static_cast<Uint32>(y) * 19349663u) ^ simulationSeed) | 1u;
+        sprite.animStart = -nextRandom(seed) * animations[sprite.currentAnim].duration();
+    }
+    return sprite;
+}
+
+// Fresh NPC state for a map object placed at a world position. The RNG is
+// seeded from the position like the animation phase, mixed so that nearby
+// positions and small seeds do not start xorshift on weak states, and never
+// zero, which xorshift would keep forever.
+NPCState placeNPCState(int x, int y) {
+    Uint32 h = (static_cast<Uint32>(x) * 83492791u) ^ (static_cast<Uint32>(y) * 2654435761u) ^ simulationSeed ^ 0x9E3779B9u;
+    h ^= h >> 16;
+    h *= 0x85EBCA6Bu;
+    h ^= h >> 13;
+    h *= 0xC2B2AE35u;
+    h ^= h >> 16;
+    NPCState state;
+    state.rngState = h | 1u;
+    return state;
+}
+
+// Turn a chunk's records into entities; only reads mapTemplates, so this
+// runs on the streaming thread as well
+void buildChunk(WorldChunk& chunk) {
+    for (const ChunkRecord& record : chunk.records) {
+        ChunkEntity entity;
+        entity.sprite = placeSprite(mapTemplates[record.templateId], record.pos.x, record.pos.y);
+        entity.state = placeNPCState(record.pos.x, record.pos.y);
+        entity.templateId = record.templateId;
+        chunk.entities.push_back(entity);
+    }
+    chunk.records.clear();
+    chunk.records.shrink_to_fit();
+}
+
+// Background thread building prefetched chunks
+struct ChunkStreamer {
+    std::thread worker;
+    std::mutex mutex;
+    std::condition_variable wake, idle;
+    std::deque<int> queue;   // Chunk indices in PREFETCHING state
+    bool busy = false;
+    bool stopping = false;
+
+    ~ChunkStreamer() { stop(); }
+
+    void start() {
+        stopping = false;
+        worker = std::thread([this]() {
+            std::unique_lock<std::mutex> lock(mutex);
+            while (true) {
+                wake.wait(lock, [this]() { return stopping || !queue.empty(); });
+                if (queue.empty()) return;
+                int index = queue.front();
+                queue.pop_front();
+                busy = true;
+                lock.unlock();
+                buildChunk(worldChunks[index]);
+                worldChunks[index].state = WorldChunk::READY;
+                lock.lock();
+                busy = false;
+                idle.notify_all();
+            }
+        });
+    }
+
+    void stop() {
+        if (!worker.joinable()) return;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+            queue.clear();
+        }
+        wake.notify_all();
+        worker.join();
+    }
+
+    void enqueue(int index) {
+        allocationCheck.exemptFrame();
+        worldChunks[index].state = WorldChunk::PREFETCHING;
+        if (!worker.joinable()) {
+            // No streaming thread: build inline
+            buildChunk(worldChunks[index]);
+            worldChunks[index].state = WorldChunk::READY;
+            return;
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        queue.push_back(index);
+        wake.notify_one();
+    }
+
+    // Build a queued chunk now, or wait for the thread to finish it
+    void finish(int index) {
+        std::unique_lock<std::mutex> lock(mutex);
+        auto it = std::find(queue.begin(), queue.end(), index);
+        if (it != queue.end()) {
+            queue.erase(it);
+            lock.unlock();
+            buildChunk(worldChunks[index]);
+            worldChunks[index].state = WorldChunk::READY;
+            return;
+        }
+        idle.wait(lock, [&]() { return worldChunks[index].state != WorldChunk::PREFETCHING; });
+    }
+
+    // Wait until every queued chunk is built
+    void flush() {
+        std::unique_lock<std::mutex> lock(mutex);
+        idle.wait(lock, [this]() { return queue.empty() && !busy; });
+    }
+
+    // Wait until nothing is queued or being built
+    void drain() {
+        std::unique_lock<std::mutex> lock(mutex);
+        queue.clear();
+        idle.wait(lock, [this]() { return !busy; });
+    }
+};
+
+ChunkStreamer chunkStreamer;
+
+// Base folder of an animation's frames (everything before the first capital letter)
+std::string animationBaseFolder(const std::string& animName) {
+    size_t firstCap = 0;
+    while (firstCap < animName.length() && !isupper(animName[firstCap])) {
+        firstCap++;
+    }
+    return animName.substr(0, firstCap);  // "aaron" or "mushroom"
+}
+
+// Asset cache keys are source paths, so text levels and bundles share entries
+std::string textureAssetKey(const std::string& levelName, const std::string& textureName) {
+    return "assets/textures/" + levelName + "/" + textureName + ".png";
+}
+
+std::string animationAssetKey(const std::string& animName, int frameCount) {
+    return "assets/animations/" + animationBaseFolder(animName) + "/" + animName + "#" + std::to_string(frameCount);
+}
+
+// Loads the frames of on-demand animations when a sprite first needs them.
+// The simulation requests an animation when a sprite switches to it (and the
+// player's likely next ones), a background thread decodes the frames, and
+// the main thread uploads them between frames; until then the sprite keeps
+// its previous image. Loaded frames stay resident until they exceed their
+// VRAM budget, then the least recently shown animations are evicted.
+struct AnimationLoader {
+    struct Decoded {
+        AnimId anim;
+        std::string name;                  // Animation name when requested, to drop stale results
+        std::vector<SDL_Surface*> frames;  // Empty when a frame failed to load
+    };
+
+    std::thread worker;
+    std::mutex mutex;
+    std::condition_variable wake;
+    struct Request {
+        AnimId anim;
+        std::string name;
+        int frameCount;
+    };
+    std::deque<Request> queue;                          // Requested animations
+    std::vector<Decoded> decoded;                       // Waiting for upload
+    bool busy = false;                                  // Decoding an animation
+    bool stopping = false;
+
+    // Written by the simulation, read by the main thread between frames
+    std::vector<char> queued;          // Request pending, by AnimId
+    std::vector<Uint64> lastShown;     // Frame an animation was last shown, by AnimId
+    Uint64 frame = 0;
+
+    size_t budgetBytes = size_t(32) << 20;  // --anim-vram-budget=<MB>
+    size_t residentBytes = 0;               // On-demand frames resident after the last upload
+
+    ~AnimationLoader() { stop(); }
+
+    void start() {
+        stopping = false;
+        worker = std::thread([this]() {
+            std::unique_lock<std::mutex> lock(mutex);
+            while (true) {
+                wake.wait(lock, [this]() { return stopping || !queue.empty(); });
+                if (queue.empty()) return;
+                Request request = queue.front();
+                queue.pop_front();
+                busy = true;
+                lock.unlock();
+                Decoded result = decode(request);
+                lock.lock();
+                decoded.push_back(std::move(result));
+                busy = false;
+            }
+        });
+    }
+
+    void stop() {
+        if (!worker.joinable()) return;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+            queue.clear();
+        }
+        wake.notify_all();
+        worker.join();
+        for (Decoded& result : decoded) {
+            for (SDL_Surface* image : result.frames) SDL_FreeSurface(image);
+        }
+        decoded.clear();
+    }
+
+    // Forget the outgoing level's requests when the animations table is
+    // rebuilt; a decode still in flight is dropped by update()
+    void reset() {
+        std::lock_guard<std::mutex> lock(mutex);
+        queue.clear();
+        for (Decoded& result : decoded) {
+            for (SDL_Surface* image : result.frames) SDL_FreeSurface(image);
+        }
+        decoded.clear();
+        queued.clear();
+        lastShown.clear();
+    }
+
+    // Decode every frame of an animation (any thread; animations may change
+    // meanwhile, so the request carries what the decode needs)
+    Decoded decode(const Request& request) {
+        Decoded result = {request.anim, request.name, {}};
+        std::string framePrefix = "assets/animations/" + animationBaseFolder(request.name) + "/" + request.name;
+        for (int i = 1; i <= request.frameCount; i++) {
+            std::string path = framePrefix + std::to_string(i) + ".png";
+            SDL_Surface* surface = IMG_Load(path.c_str());
+            if (!surface) {
+                LOG(LOG_ERROR, "Failed to load frame: " << path << " - " << IMG_GetError());
+                for (SDL_Surface* image : result.frames) SDL_FreeSurface(image);
+                result.frames.clear();
+                break;
+            }
+            result.frames.push_back(surface);
+        }
+        return result;
+    }
+
+    // Ask for an animation's frames; a no-op once they are resident or requested
+    void request(AnimId anim) {
+        if (anim == INVALID_ANIM) return;
+        const animation& A = animations[anim];
+        if (!A.onDemand || !A.frames.empty()) return;
+        if (queued.size() <= static_cast<size_t>(anim)) {
+            allocationCheck.exemptFrame();
+            queued.resize(animations.size(), 0);
+        }
+        if (queued[anim]) return;
+        queued[anim] = 1;
+        allocationCheck.exemptFrame();
+        if (!worker.joinable()) {
+            // No loader thread: decode inline, upload with the others
+            Decoded result = decode({anim, A.name, A.frameCount});
+            std::lock_guard<std::mutex> lock(mutex);
+            decoded.push_back(std::move(result));
+            return;
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        queue.push_back({anim, A.name, A.frameCount});
+        wake.notify_one();
+    }
+
+    // Request an animation that may be needed soon, while the budget has room
+    void prefetch(AnimId anim) {
+        if (residentBytes < budgetBytes) request(anim);
+    }
+
+    // Note that an animation's frames were shown this frame
+    void touch(AnimId anim) {
+        if (!animations[anim].onDemand) return;
+        if (lastShown.size() <= static_cast<size_t>(anim)) {
+            allocationCheck.exemptFrame();
+            lastShown.resize(animations.size(), 0);
+        }
+        lastShown[anim] = frame;
+    }
+
+    // Upload the animations decoded so far and trim to the budget (main
+    // thread, between frames)
+    void update() {
+        frame++;
+        std::vector<Decoded> ready;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (decoded.empty()) return;
+            ready.swap(decoded);
+        }
+        allocationCheck.exemptFrame();
+        for (Decoded& result : ready) {
+            if (static_cast<size_t>(result.anim) < queued.size()) queued[result.anim] = 0;
+            if (static_cast<size_t>(result.anim) >= animations.size()) {
+                for (SDL_Surface* image : result.frames) SDL_FreeSurface(image);
+                continue;
+            }
+            animation& anim = animations[result.anim];
+            bool wanted = anim.name == result.name && anim.onDemand && anim.frames.empty() &&
+                          static_cast<int>(result.frames.size()) == anim.frameCount;
+            if (!wanted) {
+                // Failed frames are not retried until the level loads again
+                if (anim.name == result.name && result.frames.empty()) anim.onDemand = false;
+                for (SDL_Surface* image : result.frames) SDL_FreeSurface(image);
+                continue;
+            }
+
+            // Own pages per animation, so an eviction frees nothing else
+            std::vector<SDL_Texture*> pages;
+            std::vector<AtlasRegion> regions = buildAtlas(result.frames, pages);
+            for (SDL_Texture* page : pages) assetCache.addPage(page);
+            int asset = assetCache.add(animationAssetKey(anim.name, anim.frameCount), anim.name, true, regions);
+            assetCache.release(asset);  // Not held by the level, so trim() may evict it too
+            anim.frames = regions;
+            if (lastShown.size() <= static_cast<size_t>(result.anim)) lastShown.resize(animations.size(), 0);
+            lastShown[result.anim] = frame;
+        }
+        trim();
+    }
+
+    // Evict resident on-demand animations, least recently shown first, until
+    // they fit the budget. Animations uploaded or shown in the last frame and
+    // frames a live sprite still shows stay, which also covers the frame
+    // recorded for the next render.
+    void trim() {
+        residentBytes = 0;
+        std::vector<std::pair<AnimId, int>> resident;  // Animation, asset
+        for (AnimId id = 0; id < static_cast<AnimId>(animations.size()); id++) {
+            const animation& anim = animations[id];
+            if (!anim.onDemand || anim.frames.empty()) continue;
+            auto it = assetCache.lookup.find(animationAssetKey(anim.name, anim.frameCount));
+            if (it == assetCache.lookup.end() || !assetCache.assets[it->second].resident) continue;
+            for (int p : assetCache.assets[it->second].pages) residentBytes += assetCache.pages[p].bytes;
+            resident.push_back({id, it->second});
+        }
+        if (residentBytes <= budgetBytes) return;
+
+        auto shownAt = [this](AnimId id) { return static_cast<size_t>(id) < lastShown.size() ? lastShown[id] : 0; };
+        std::sort(resident.begin(), resident.end(), [&](const auto& a, const auto& b) {
+            return shownAt(a.first) < shownAt(b.first);
+        });
+        for (const auto& [id, asset] : resident) {
+            if (residentBytes <= budgetBytes) break;
+            if (shownAt(id) + 1 >= frame) continue;
+            std::vector<int> pages = assetCache.assets[asset].pages;
+            bool shown = false;
+            for (const GameSprite& sprite : gameSprites) {
+                if (!sprite.alive) continue;
+                for (int p : pages) shown |= sprite.currentImage.page == assetCache.pages[p].texture;
+            }
+            if (shown) continue;
+            for (int p : pages) {
+                residentBytes -= assetCache.pages[p].bytes;
+                assetCache.evictPage(p);
+            }
+        }
+    }
+};
+
+AnimationLoader animationLoader;
+
+// Audio: streamed music and cached sound effects on the mixer device opened
+// by initSDL(). Sound effects are decoded when a level loads and stay cached
+// for later levels; the simulation triggers them with queueSound() and the
+// main thread plays each frame's sounds, loudest first, within the voice
+// limits. Music files are assets/music/<level>.wav, sound effects
+// assets/sounds/<name>.wav (footstep, or a sprite kind whose animation loops).
+const int MAX_VOICES = 16;           // Mixer channels for sound effects
+const int MAX_SOUND_INSTANCES = 4;   // Voices one sound may use at once
+const float MIN_SOUND_GAIN = 0.02f;  // Quieter sounds are not played
+
+// Sample format of a PCM WAV file and where its samples are
+struct WavInfo {
+    SDL_AudioFormat format = 0;
+    int channels = 0, rate = 0;
+    std::streamoff dataStart = 0;
+    Uint32 dataSize = 0;
+};
+const Uint32 MAX_WAV_FORMAT_SIZE = 64;  // Larger fmt chunks are rejected as corrupt
+
+// Read a WAV file's header up to its data chunk (8, 16, 32-bit integer and
+// 32-bit float PCM)
+bool readWavHeader(std::ifstream& file, WavInfo& info) {
+    char riff[12];
+    if (!file.read(riff, sizeof(riff)) || std::memcmp(riff, "RIFF", 4) != 0 || std::memcmp(riff + 8, "WAVE", 4) != 0) {
+        return false;
+    }
+    bool haveFormat = false;
+    char chunk[8];
+    while (file.read(chunk, sizeof(chunk))) {
+        Uint32 size;
+        std::memcpy(&size, chunk + 4, sizeof(size));
+        if (std::memcmp(chunk, "data", 4) == 0) {
+            info.dataStart = file.tellg();
+            info.dataSize = size;
+            return haveFormat;
+        }
+        std::streamoff padded = std::streamoff(size) + (size & 1);
+        if (std::memcmp(chunk, "fmt ", 4) != 0) {
+            // Sizes come from the file: skip other chunks without reading them
+            if (!file.seekg(padded, std::ios::cur)) return false;
+            continue;
+        }
+        char body[MAX_WAV_FORMAT_SIZE];
+        if (size < 16 || size > sizeof(body) || !file.read(body, padded)) return false;
+
+        Uint16 tag, channels, bits;
+        Uint32 rate;
+        std::memcpy(&tag, body, 2);
+        std::memcpy(&channels, body + 2, 2);
+        std::memcpy(&rate, body + 4, 4);
+        std::memcpy(&bits, body + 14, 2);
+        if (tag == 0xFFFE && size >= 26) std::memcpy(&tag, body + 24, 2);  // WAVE_FORMAT_EXTENSIBLE subformat
+        if (tag == 1 && bits == 8) info.format = AUDIO_U8;
+        else if (tag == 1 && bits == 16) info.format = AUDIO_S16LSB;
+        else if (tag == 1 && bits == 32) info.format = AUDIO_S32LSB;
+        else if (tag == 3 && bits == 32) info.format = AUDIO_F32LSB;
+        else return false;
+        info.channels = channels;
+        info.rate = static_cast<int>(rate);
+        haveFormat = channels > 0 && rate > 0;
+    }
+    return false;
+}
+
+// Looping music streamed from disk: a background thread reads the file in
+// blocks, converts them to the device format and queues them in a ring
+// buffer that the mixer's music hook drains on the audio thread. Only the
+// hook advances readPos and only the thread advances writePos.
+struct MusicStream {
+    static constexpr size_t READ_BLOCK = 16 << 10;  // File bytes per read
+
+    std::thread worker;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::string requested;     // File to play next, empty for silence
+    bool changed = false;
+    bool stopping = false;
+
+    std::vector<Uint8> ring;   // Half a second of device samples
+    std::atomic<size_t> readPos{0}, writePos{0};  // Bytes ever consumed and queued
+    std::atomic<size_t> skipTo{0};                // Queued audio before this belongs to the previous track
+    std::atomic<int> volume{MIX_MAX_VOLUME / 2};
+    SDL_AudioFormat format = AUDIO_S16SYS;        // Device format
+    int channels = 2, rate = 44100;
+    size_t frameBytes = 4;
+
+    ~MusicStream() { stop(); }
+
+    void start() {
+        Uint16 deviceFormat;
+        if (Mix_QuerySpec(&rate, &deviceFormat, &channels)) format = deviceFormat;
+        frameBytes = size_t(SDL_AUDIO_BITSIZE(format) / 8) * channels;
+        ring.assign(size_t(rate / 2) * frameBytes, 0);
+        stopping = false;
+        worker = std::thread([this]() { run(); });
+        Mix_HookMusic(mix, this);
+    }
+
+    void stop() {
+        if (!worker.joinable()) return;
+        Mix_HookMusic(nullptr, nullptr);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        worker.join();
+    }
+
+    // Switch to a file, or to silence with an empty path
+    void play(const std::string& path) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (path == requested) return;
+        requested = path;
+        changed = true;
+        wake.notify_one();
+    }
+
+    // Mixer music hook (audio thread): add queued samples to the stream
+    static void SDLCALL mix(void* userdata, Uint8* stream, int len) {
+        MusicStream& music = *static_cast<MusicStream*>(userdata);
+        size_t read = std::max(music.readPos.load(std::memory_order_relaxed), music.skipTo.load(std::memory_order_acquire));
+        size_t available = music.writePos.load(std::memory_order_acquire) - read;
+        size_t n = std::min(available, static_cast<size_t>(len)) / music.frameBytes * music.frameBytes;
+        size_t offset = read % music.ring.size();
+        size_t first = std::min(n, music.ring.size() - offset);
+        int volume = music.volume.load(std::memory_order_relaxed);
+        SDL_MixAudioFormat(stream, &music.ring[offset], music.format, static_cast<Uint32>(first), volume);
+        if (n > first) SDL_MixAudioFormat(stream + first, music.ring.data(), music.format, static_cast<Uint32>(n - first), volume);
+        music.readPos.store(read + n, std::memory_order_release);
+    }
+
+    // Streaming thread: open requested files and keep the ring topped up
+    void run() {
+        std::ifstream file;
+        WavInfo info;
+        Uint32 dataRead = 0;
+        SDL_AudioStream* converter = nullptr;
+        std::vector<char> block(READ_BLOCK);
+        std::vector<Uint8> converted(READ_BLOCK);
+        while (true) {
+            std::string next;
+            bool open = false;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait_for(lock, std::chrono::milliseconds(20), [this]() { return stopping || changed; });
+                if (stopping) break;
+                if (changed) {
+                    next = requested;
+                    changed = false;
+                    open = true;
+                }
+            }
+            if (open) {
+                // Drop what is queued of the previous track
+                skipTo.store(writePos.load(std::memory_order_relaxed), std::memory_order_release);
+                if (converter) SDL_FreeAudioStream(converter);
+                converter = nullptr;
+                file.close();
+                file.clear();
+                if (!next.empty()) {
+                    file.open(next, std::ios::binary);
+                    info = WavInfo();
+                    if (!file || !readWavHeader(file, info)) {
+                        LOG(LOG_ERROR, "Could not stream music (PCM WAV only): " << next);
+                    } else {
+                        converter = SDL_NewAudioStream(info.format, static_cast<Uint8>(info.channels), info.rate,
+                                                       format, static_cast<Uint8>(channels), rate);
+                        if (!converter) LOG(LOG_ERROR, "Could not convert music " << next << ": " << SDL_GetError());
+                        dataRead = 0;
+                        LOG(LOG_INFO, "Streaming music: " << next);
+                    }
+                }
+            }
+            if (!converter) continue;
+
+            // Top up the ring: convert another block whenever the converter runs dry
+            size_t sourceFrame = size_t(SDL_AUDIO_BITSIZE(info.format) / 8) * info.channels;
+            while (true) {
+                size_t queued = writePos.load(std::memory_order_relaxed) - readPos.load(std::memory_order_acquire);
+                size_t space = (ring.size() - std::min(queued, ring.size())) / frameBytes * frameBytes;
+                if (space == 0) break;
+                if (SDL_AudioStreamAvailable(converter) == 0) {
+                    if (dataRead >= info.dataSize) {
+                        // Loop from the start
+                        file.clear();
+                        file.seekg(info.dataStart);
+                        dataRead = 0;
+                    }
+                    size_t bytes = std::min<size_t>(READ_BLOCK, info.dataSize - dataRead) / sourceFrame * sourceFrame;
+                    if (bytes == 0 || !file.read(block.data(), bytes)) {
+                        LOG(LOG_ERROR, "Music stream ended early: " << next);
+                        SDL_FreeAudioStream(converter);
+                        converter = nullptr;
+                        break;
+                    }
+                    dataRead += static_cast<Uint32>(bytes);
+                    SDL_AudioStreamPut(converter, block.data(), static_cast<int>(bytes));
+                }
+                size_t want = std::min(space, converted.size() / frameBytes * frameBytes);
+                int got = SDL_AudioStreamGet(converter, converted.data(), static_cast<int>(want));
+                if (got <= 0) continue;
+                size_t write = writePos.load(std::memory_order_relaxed);
+                size_t offset = write % ring.size();
+                size_t first = std::min(static_cast<size_t>(got), ring.size() - offset);
+                std::memcpy(&ring[offset], converted.data(), first);
+                std::memcpy(ring.data(), converted.data() + first, got - first);
+                writePos.store(write + got, std::memory_order_release);
+            }
+        }
+        if (converter) SDL_FreeAudioStream(converter);
+    }
+};
+
+// A sound effect file read on a worker thread
+struct SoundLoadJob {
+    std::vector<char> data;
+    std::string error;  // Why the file could not be read, set on the worker
+};
+
+struct AudioSystem {
+    bool enabled = true;        // --no-audio
+    bool running = false;
+    std::vector<Mix_Chunk*> sounds;                 // Cached sound effects, null when loading failed
+    std::unordered_map<std::string, int> soundMap;  // Path -> sound index
+    int voiceSound[MAX_VOICES];                     // Sound last started on each voice
+    float voiceGain[MAX_VOICES];
+    int sfxVolume = MIX_MAX_VOLUME;
+    MusicStream music;
+
+    // Start after initSDL() opened the mixer
+    void start() {
+        if (!enabled) return;
+        Mix_AllocateChannels(MAX_VOICES);
+        std::fill(std::begin(voiceSound), std::end(voiceSound), -1);
+        std::fill(std::begin(voiceGain), std::end(voiceGain), 0.0f);
+        pendingSounds.reserve(MAX_FRAME_SOUNDS);
+        music.start();
+        running = true;
+    }
+
+    void stop() {
+        if (!running) return;
+        music.stop();
+        Mix_HaltChannel(-1);
+        for (Mix_Chunk* chunk : sounds) {
+            if (chunk) Mix_FreeChunk(chunk);
+        }
+        sounds.clear();
+        soundMap.clear();
+        running = false;
+    }
+
+    // Cached sound of a file, or -1 when it does not exist or will not load.
+    // Files not yet cached are only listed in toLoad.
+    int lookup(const std::string& path, std::vector<std::pair<std::string, int>>& toLoad) {
+        auto it = soundMap.find(path);
+        if (it != soundMap.end()) return sounds[it->second] ? it->second : -1;
+        if (!std::filesystem::exists(path)) return -1;
+        int index = static_cast<int>(sounds.size());
+        soundMap[path] = index;
+        sounds.push_back(nullptr);
+        toLoad.push_back({path, index});
+        return index;
+    }
+
+    // Load the sounds and music of the level just loaded
+    void loadLevel(const std::string& levelName) {
+        if (!running) return;
+        std::vector<std::pair<std::string, int>> toLoad;
+        std::vector<std::pair<NameId, int>> kinds;
+        footstepSound = lookup("assets/sounds/footstep.wav", toLoad);
+        for (const GameSprite& tmpl : mapTemplates) {
+            if (tmpl.currentAnim == INVALID_ANIM) continue;
+            int sound = lookup("assets/sounds/" + nameTable[tmpl.kind] + ".wav", toLoad);
+            if (sound >= 0) kinds.push_back({tmpl.kind, sound});
+        }
+
+        // Read the files off the main thread, all at once; SDL_mixer is only
+        // called here, so its chunks are built on this thread
+        std::vector<SoundLoadJob> jobs(toLoad.size());
+        jobSystem.parallelFor(jobs.size(), 1, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) {
+                std::ifstream file(toLoad[i].first, std::ios::binary);
+                if (!file) {
+                    jobs[i].error = std::strerror(errno);
+                    continue;
+                }
+                jobs[i].data.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+                if (file.bad()) jobs[i].error = "read failed";
+            }
+        });
+        for (size_t i = 0; i < jobs.size(); i++) {
+            const auto& [path, index] = toLoad[i];
+            if (jobs[i].error.empty()) {
+                SDL_RWops* rw = SDL_RWFromConstMem(jobs[i].data.data(), static_cast<int>(jobs[i].data.size()));
+                sounds[index] = Mix_LoadWAV_RW(rw, 1);
+                if (!sounds[index]) jobs[i].error = Mix_GetError();
+            }
+            if (!sounds[index]) LOG(LOG_ERROR, "Failed to load sound: " << path << " - " << jobs[i].error);
+        }
+        if (footstepSound >= 0 && !sounds[footstepSound]) footstepSound = -1;
+        kindSounds.assign(nameTable.size(), -1);
+        for (const auto& [kind, sound] : kinds) {
+            if (sounds[sound]) kindSounds[kind] = sound;
+        }
+        if (!toLoad.empty()) LOG(LOG_INFO, "Loaded " << toLoad.size() << " sounds, " << sounds.size() << " cached");
+
+        std::string musicPath = "assets/music/" + levelName + ".wav";
+        music.play(std::filesystem::exists(musicPath) ? musicPath : std::string());
+    }
+
+    // Start a frame's sounds (main thread). Loudest first: a sound already
+    // on MAX_SOUND_INSTANCES voices is skipped, and with every voice busy a
+    // louder sound takes over the quietest voice.
+    void play(const std::vector<SoundCommand>& commands) {
+        if (!running || commands.empty()) return;
+        int order[MAX_FRAME_SOUNDS];
+        int count = static_cast<int>(std::min(commands.size(), MAX_FRAME_SOUNDS));
+        for (int i = 0; i < count; i++) order[i] = i;
+        std::sort(order, order + count, [&](int a, int b) { return commands[a].gain > commands[b].gain; });
+
+        for (int i = 0; i < count; i++) {
+            const SoundCommand& command = commands[order[i]];
+            if (command.gain < MIN_SOUND_GAIN) break;
+            int instances = 0, freeVoice = -1, quietest = -1;
+            for (int voice = 0; voice < MAX_VOICES; voice++) {
+                if (!Mix_Playing(voice)) {
+                    if (freeVoice < 0) freeVoice = voice;
+                    continue;
+                }
+                if (voiceSound[voice] == command.sound) instances++;
+                if (quietest < 0 || voiceGain[voice] < voiceGain[quietest]) quietest = voice;
+            }
+            if (instances >= MAX_SOUND_INSTANCES) continue;
+            int voice = freeVoice;
+            if (voice < 0) {
+                if (quietest < 0 || voiceGain[quietest] >= command.gain) continue;
+                Mix_HaltChannel(quietest);
+                voice = quietest;
+            }
+
+            // Equal-power pan
+            float angle = (command.pan + 1.0f) * static_cast<float>(M_PI) / 4.0f;
+            Mix_SetPanning(voice, static_cast<Uint8>(255.0f * std::cos(angle)), static_cast<Uint8>(255.0f * std::sin(angle)));
+            Mix_Volume(voice, static_cast<int>(command.gain * sfxVolume));
+            if (Mix_PlayChannel(voice, sounds[command.sound], 0) < 0) continue;
+            voiceSound[voice] = command.sound;
+            voiceGain[voice] = command.gain;
+        }
+    }
+};
+
+AudioSystem audio;
+
+std::string loadedLevelPath;  // Text level the world was loaded from, empty for bundles and generated levels
+
+// Set up an empty world of the given size for the level being loaded
+void beginWorld(int width, int height) {
+    chunkStreamer.drain();
+    worldWidth = width;
+    worldHeight = height;
+    spatialGrid.reset(worldWidth, worldHeight, GRID_CELL_SIZE);
+    chunkCols = (worldWidth + CHUNK_SIZE - 1) / CHUNK_SIZE;
+    chunkRows = (worldHeight + CHUNK_SIZE - 1) / CHUNK_SIZE;
+    worldChunks.reset(new WorldChunk[chunkCols * chunkRows]);
+    clearStaticLayers();
+    mapTemplates.clear();
+    loadedLevelPath.clear();
+}
+
+// Spawn a sprite tracked by the chunk system, with the NPC state it was
+// placed or frozen with
+EntityId spawnChunkEntity(const ChunkEntity& entity) {
+    EntityId id = spawnSprite(entity.sprite);
+    npcStates[id] = entity.state;
+    if (entityTemplates.size() <= id) entityTemplates.resize(id + 1, -1);
+    entityTemplates[id] = entity.templateId;
+    return id;
+}
+
+// Add a map object; persistent objects (the player, the background and
+// anything larger than a chunk) spawn now, the rest go to their chunk as a
+// record, or straight to its entities when the chunk is already built. Must
+// not target a chunk the streaming thread is building.
+void addMapObject(int templateId, int x, int y) {
+    const GameSprite& tmpl = mapTemplates[templateId];
+    bool isPlayer = tmpl.kind == kindPlayer && playerId == INVALID_ENTITY;
+    if (isPlayer || tmpl.kind == kindBackground || tmpl.rect.w > CHUNK_SIZE || tmpl.rect.h > CHUNK_SIZE) {
+        EntityId id = spawnSprite(placeSprite(tmpl, x, y));
+        if (entityTemplates.size() <= id) entityTemplates.resize(id + 1, -1);
+        entityTemplates[id] = -1;
+        if (isPlayer) playerId = id;
+        return;
+    }
+    GameSprite placed = placeSprite(tmpl, x, y);
+    WorldChunk& chunk = worldChunks[chunkOf(placed)];
+    if (chunk.state == WorldChunk::ACTIVE) {
+        spawnChunkEntity({placed, placeNPCState(x, y), templateId});
+    } else if (chunk.state == WorldChunk::READY) {
+        chunk.entities.push_back({placed, placeNPCState(x, y), templateId});
+    } else {
+        chunk.records.push_back({templateId, {x, y}});
+    }
+}
+
+// Chunk range around the camera view, widened by a margin in chunks
+SDL_Rect chunkRangeAroundView(int margin) {
+    SDL_Rect view = cameraWorldRect();
+    int x0 = std::max(0, view.x / CHUNK_SIZE - margin);
+    int y0 = std::max(0, view.y / CHUNK_SIZE - margin);
+    int x1 = std::min(chunkCols - 1, (view.x + view.w) / CHUNK_SIZE + margin);
+    int y1 = std::min(chunkRows - 1, (view.y + view.h) / CHUNK_SIZE + margin);
+    return {x0, y0, x1 - x0 + 1, y1 - y0 + 1};
+}
+
+// Activate, prefetch, freeze and evict chunks around the camera
+void updateWorldStreaming() {
+    if (!worldChunks) return;
+    SDL_Rect active = chunkRangeAroundView(CHUNK_ACTIVE_MARGIN);
+    SDL_Rect prefetch = chunkRangeAroundView(CHUNK_PREFETCH_MARGIN);
+    SDL_Rect keep = chunkRangeAroundView(CHUNK_EVICT_MARGIN);
+    auto inRange = [](const SDL_Rect& range, int index) {
+        SDL_Point p = {index % chunkCols, index / chunkCols};
+        return SDL_PointInRect(&p, &range) == SDL_TRUE;
+    };
+
+    // Chunks that left the active area stop simulating
+    for (int i = 0; i < chunkCols * chunkRows; i++) {
+        if (worldChunks[i].state == WorldChunk::ACTIVE && !inRange(active, i)) {
+            worldChunks[i].state = WorldChunk::READY;
+        }
+    }
+
+    // Freeze chunk entities standing outside the active area
+    for (EntityId id = 0; id < gameSprites.size(); id++) {
+        const GameSprite& sprite = gameSprites[id];
+        if (!sprite.alive || id >= entityTemplates.size() || entityTemplates[id] < 0) continue;
+        WorldChunk& chunk = worldChunks[chunkOf(sprite)];
+        int state = chunk.state;
+        if (state == WorldChunk::ACTIVE || state == WorldChunk::PREFETCHING) continue;
+        chunk.entities.push_back({sprite, npcStates[id], entityTemplates[id]});
+        despawnSprite(id);
+    }
+
+    for (int y = keep.y; y < keep.y + keep.h; y++) {
+        for (int x = keep.x; x < keep.x + keep.w; x++) {
+            int i = y * chunkCols + x;
+            WorldChunk& chunk = worldChunks[i];
+            if (inRange(active, i) && chunk.state != WorldChunk::ACTIVE) {
+                // Spawn everything in a newly active chunk
+                if (chunk.state == WorldChunk::PREFETCHING) chunkStreamer.finish(i);
+                buildChunk(chunk);
+                for (const ChunkEntity& entity : chunk.entities) spawnChunkEntity(entity);
+                chunk.entities.clear();
+                chunk.state = WorldChunk::ACTIVE;
+            } else if (inRange(prefetch, i) && chunk.state == WorldChunk::COLD && !chunk.records.empty()) {
+                chunkStreamer.enqueue(i);
+            }
+        }
+    }
+
+    // Compact distant chunks back to records
+    for (int i = 0; i < chunkCols * chunkRows; i++) {
+        WorldChunk& chunk = worldChunks[i];
+        if (inRange(keep, i) || chunk.state != WorldChunk::READY) continue;
+        allocationCheck.exemptFrame();
+        for (const ChunkEntity& entity : chunk.entities) {
+            chunk.records.push_back({entity.templateId, {entity.sprite.rect.x, entity.sprite.rect.y}});
+        }
+        chunk.entities.clear();
+        chunk.entities.shrink_to_fit();
+        chunk.state = WorldChunk::COLD;
+    }
+}
+
+// Select the current frame of every visible animated sprite from the clock;
+// sprites off screen are not touched at all
+void updateVisibleAnimations() {
+    for (EntityId id : drawOrder) {
+        GameSprite& sprite = gameSprites[id];
+        if (sprite.currentAnim == INVALID_ANIM || id == playerId) continue;
+        const animation& anim = animations[sprite.currentAnim];
+        int frame = anim.frameAt(animationClock - sprite.animStart);
+        if (anim.frames.empty()) {
+            // Keep the previous image until the frames are loaded
+            sprite.currentFrame = frame;
+            animationLoader.request(sprite.currentAnim);
+            continue;
+        }
+        if (frame != sprite.currentFrame || sprite.currentImage.page != anim.frames[frame].page) {
+            if (frame < sprite.currentFrame && static_cast<size_t>(sprite.kind) < kindSounds.size()) {
+                // The animation looped
+                queueSound(kindSounds[sprite.kind], sprite.posX + sprite.rect.w / 2.0f, sprite.posY + sprite.rect.h);
+            }
+            sprite.currentFrame = frame;
+            sprite.currentImage = anim.frames[frame];
+        }
+        animationLoader.touch(sprite.currentAnim);
+    }
+}
+
+// Load textures from a manifest file
+void loadTexturesFromFile(const std::string& filePath) {
+    std::ifstream file(filePath);
+    if (!file.is_open()) {
+        LOG(LOG_ERROR, "Could not open file: " << filePath);
+        return;
+    }
+
+    std::string line;
+    while (std::getline(file, line)) {
+        // Load image file
+        SDL_Surface* surface = IMG_Load(line.c_str());
+        if (!surface) {
+            LOG(LOG_ERROR, "Unable to load texture: " << line << " Error: " << IMG_GetError());
+            continue;
+        }
+
+        // Create texture from surface
+        SDL_Texture* texture = SDL_CreateTextureFromSurface(renderer, surface);
+        if (!texture) {
+            LOG(LOG_ERROR, "Unable to create texture! SDL Error: " << SDL_GetError());
+            SDL_FreeSurface(surface);
+            continue;
+        }
+
+        // Extract texture name from path
+        std::string textureName = line.substr(line.find_last_of("/\\") + 1);
+        textureName = textureName.substr(0, textureName.find('.'));
+        
+        // Create sprite with default values
+        GameSprite sprite{
+            {0, 0, surface->w, surface->h},  // rect
+            {0, 0, 32, 32},                  // footRect (default size)
+            32,                              // footW
+            32,                              // footH
+            wholeTexture(texture),           // currentImage
+            internName(textureName),         // kind
+            0,                               // currentFrame
+            false,                           // isAnimated
+            false                            // isMoving
+        };
+        
+        // Add to containers
+        spawnSprite(sprite);
+        static_textures.push_back(texture);
+        static_texture_rects.insert({0, 0, surface->w, surface->h});
+        SDL_FreeSurface(surface);
+    }
+}
+
+// Empty the entity store and every per-entity table
+void clearWorld() {
+    chunkStreamer.drain();
+    gameSprites.clear();
+    freeEntities.clear();
+    entityTemplates.clear();
+    npcStates.clear();
+    drawOrder.clear();
+    drawMarks.clear();
+    playerId = INVALID_ENTITY;
+}
+
+// Forget every texture and animation name before a level or bundle loads, so
+// only assets that load references resolve
+void clearLevelNames() {
+    textureMap.clear();
+    textureFootMap.clear();
+    animationMap.clear();
+    animations.clear();
+    animationLoader.reset();
+}
+
+// Load a game level
+bool loadLevel(std::string levelName) {
+    // Clear previous level data
+    for (auto& texture : static_textures) {
+        SDL_DestroyTexture(texture);
+    }
+    static_textures.clear();
+    static_texture_rects.clear();
+    clearWorld();
+    beginWorld(MAP_WIDTH, MAP_HEIGHT);
+
+    // The outgoing level's assets are released only after the new level has
+    // referenced its own, so shared assets stay resident
+    std::vector<int> previousAssets;
+    previousAssets.swap(levelAssets);
+    
+    // Prefer the baked bundle, falling back to the text map
+    bool loaded = false;
+    std::string bundlePath = "assets/levels/" + levelName + ".bundle";
+    if (std::ifstream(bundlePath).good()) {
+        clearLevelNames();
+        loaded = loadBundle(bundlePath);
+        if (!loaded) LOG(LOG_WARN, "Falling back to text level: " << levelName);
+    }
+
+    // Build level path and load map
+    if (!loaded) {
+        clearLevelNames();
+        std::string levelPath = "assets/levels/" + levelName + ".txt";
+        loaded = loadMapFile(levelPath);
+    }
+
+    for (int asset : previousAssets) assetCache.release(asset);
+    assetCache.releaseRetired();
+    assetCache.trim();
+    audio.loadLevel(levelName);
+    LOG(LOG_INFO, "Asset cache: " << (assetCache.residentBytes >> 20) << " MB resident, budget "
+                  << (assetCache.budgetBytes >> 20) << " MB");
+    return loaded;
+}
+
+// Keyboard state sampled once per frame and consumed by simulation ticks
+struct InputState {
+    bool up = false;
+    bool down = false;
+    bool left = false;
+    bool right = false;
+};
+static InputState g_input;
+
+// Input event that changes the game, handled between frames. SDL events are
+// reduced to these so a frame's input can be recorded and replayed.
+struct InputEvent {
+    enum Type : Uint8 { MOUSE_MOTION, MOUSE_DOWN, MOUSE_UP, KEY_DOWN };
+    Uint8 type;
+    Sint32 x, y;  // Mouse position, or the SDL_Keycode in x for KEY_DOWN
+};
+std::vector<InputEvent> frameEvents;  // Events of the current frame, in order
+bool replayingInput = false;          // Input comes from a --replay log instead of SDL
+
+// Apply one input event to the game
+void applyInputEvent(const InputEvent& event) {
+    switch (event.type) {
+        case InputEvent::MOUSE_MOTION:
+            if (cursor) {
+                cursor->rect.x = event.x;
+                cursor->rect.y = event.y;
+            }
+            break;
+
+        case InputEvent::MOUSE_DOWN:
+            if (cursor) {
+                // Update cursor position to the click location
+                cursor->rect.x = event.x;
+                cursor->rect.y = event.y;
+
+                SDL_Point mousePoint = { cursor->rect.x, cursor->rect.y };
+
+                // Convert to world space; only sprites indexed in the cell
+                // under the cursor can be hit
+                SDL_Point worldPoint = {
+                    static_cast<int>(std::floor(mousePoint.x / globalScale - backgroundOffset.x)),
+                    static_cast<int>(std::floor(mousePoint.y / globalScale - backgroundOffset.y))
+                };
+                spatialGrid.queryCell(worldPoint.x, worldPoint.y, visibleScratch);
+
+                // Pick the hit sprite that is drawn last (frontmost in depth order)
+                const GameSprite* topmost = nullptr;
+                for (EntityId id : visibleScratch) {
+                    const auto& sprite = gameSprites[id];
+                    if (sprite.kind == kindBackground || sprite.kind == kindCursor)
+                        continue;
+
+                    if (SDL_PointInRect(&worldPoint, &sprite.rect) && (!topmost || *topmost < sprite)) {
+                        topmost = &sprite;
+                    }
+                }
+                if (topmost) {
+                    LOG(LOG_INFO, "Mouse intersects sprite '" << nameTable[topmost->kind]
+                                  << "' rect: {"
+                                  << topmost->rect.x << ", "
+                                  << topmost->rect.y << ", "
+                                  << topmost->rect.w << ", "
+                                  << topmost->rect.h << "}");
+                } else {
+                    LOG(LOG_INFO, "No sprite under cursor.");
+                }
+            }
+            break;
+
+        case InputEvent::MOUSE_UP:
+            if (cursor) {
+                // Handle left click release on cursor
+                LOG(LOG_INFO, "Cursor released at: (" << cursor->rect.x << ", " << cursor->rect.y << ")");
+            }
+            break;
+
+        case InputEvent::KEY_DOWN:
+            switch (event.x) {
+                case SDLK_LEFT:
+                    PLAYER_SPEED--;
+                    break;
+                case SDLK_RIGHT:
+                    PLAYER_SPEED++;
+                    break;
+                case SDLK_UP:
+                    globalScale *= 1.1f;
+                    globalScale = std::min(5.0f, globalScale);
+                    break;
+                case SDLK_DOWN:
+                    globalScale *= 0.9f;
+                    globalScale = std::max(0.1f, globalScale);
+                    break;
+                case SDLK_F3:
+                    profiler.overlayVisible = !profiler.overlayVisible;
+                    break;
+                case SDLK_F4:
+                    profiler.dumpTrace("profile_trace.json");
+                    break;
+            }
+            break;
+    }
+}
+
+// Apply a live input event and keep it in frameEvents; consecutive mouse
+// motion collapses to the last position
+void handleInputEvent(const InputEvent& event) {
+    if (replayingInput) return;  // The log supplies the input
+    if (event.type == InputEvent::MOUSE_MOTION && !frameEvents.empty() &&
+        frameEvents.back().type == InputEvent::MOUSE_MOTION) {
+        frameEvents.back() = event;
+    } else {
+        frameEvents.push_back(event);
+    }
+    applyInputEvent(event);
+}
+
+// Process input events and sample keyboard state for the next ticks
+bool handleEvents() {
+    // Process keyboard state
+    const Uint8* state = SDL_GetKeyboardState(NULL);
+    SDL_ShowCursor(SDL_DISABLE);  // Hide system cursor
+
+    // Exit on ESC key
+    if(state[SDL_SCANCODE_ESCAPE]) {
+        return false;
+    }
+
+    frameEvents.clear();
+    if (!replayingInput) {
+        g_input.up    = state[SDL_SCANCODE_W];
+        g_input.down  = state[SDL_SCANCODE_S];
+        g_input.left  = state[SDL_SCANCODE_A];
+        g_input.right = state[SDL_SCANCODE_D];
+    }
+
+    // Process event queue
+    SDL_Event event;
+    while (SDL_PollEvent(&event)) {
+        switch (event.type) {
+            case SDL_QUIT: 
+                return false;
+
+            case SDL_RENDER_TARGETS_RESET:
+                // Render target contents were lost; rebuild the static layers
+                invalidateStaticLayers();
+                break;
+            
+            case SDL_MOUSEMOTION:
+                handleInputEvent({InputEvent::MOUSE_MOTION, event.motion.x, event.motion.y});
+                break;
+
+            case SDL_MOUSEBUTTONDOWN:
+                if (event.button.button == SDL_BUTTON_LEFT) {
+                    handleInputEvent({InputEvent::MOUSE_DOWN, event.button.x, event.button.y});
+                }
+                break;
+            case SDL_MOUSEBUTTONUP:
+                if (event.button.button == SDL_BUTTON_LEFT) {
+                    handleInputEvent({InputEvent::MOUSE_UP, event.button.x, event.button.y});
+                }
+                break;
+                
+            case SDL_KEYDOWN:
+                handleInputEvent({InputEvent::KEY_DOWN, event.key.keysym.sym, 0});
+                break;
+        }
+    }
+
+    return true;
+}
+
+// Advance the player by one simulation tick using the sampled input
+void updatePlayer() {
+    if (playerId == INVALID_ENTITY) return; // Skip if no player
+    profiler.count(COUNTER_ENTITIES_UPDATED);
+
+    // Player is updated in place in the entity store
+    GameSprite& updatedSprite = gameSprites[playerId];
+    updatedSprite.prevPos = {updatedSprite.posX, updatedSprite.posY};
+
+    // Calculate movement based on keyboard input (sub-pixel, no rounding)
+    float moveAmount = PLAYER_SPEED * deltaTime;
+    float moveX = 0.0f, moveY = 0.0f;
+    bool isMoving = false;
+
+    // Process movement keys
+    if (g_input.left) {
+        moveX -= moveAmount;
+        isMoving = true;
+    }
+    if (g_input.right) {
+        moveX += moveAmount;
+        isMoving = true;
+    }
+    if (g_input.up) {
+        moveY -= moveAmount;
+        isMoving = true;
+    }
+    if (g_input.down) {
+        moveY += moveAmount;
         isMoving = true;
     }
-    if (state[SDL_SCANCODE_D]) {  // Right
-        moveX += static_cast<int>(std::round(moveAmount));
-        isMoving = true;
+
+    // Determine facing direction
+    bool up    = g_input.up;
+    bool down  = g_input.down;
+    bool left  = g_input.left;
+    bool right = g_input.right;
+
+    // Track last vertical direction
+    if (up)   g_lastVertical = 'N';
+    if (down) g_lastVertical = 'S';
+
+    PlayerFacing facing;
+    
+    // Determine facing direction (whether moving or not)
+    if      (up  && !left && !right) { facing = PlayerFacing::N; }
+    else if (down&& !left && !right) { facing = PlayerFacing::S; }
+    else if (up  && right)           { facing = PlayerFacing::NE; }
+    else if (up  && left)            { facing = PlayerFacing::NW; }
+    else if (down&& right)           { facing = PlayerFacing::SE; }
+    else if (down&& left)            { facing = PlayerFacing::SW; }
+    else if (right)                  { facing = (g_lastVertical=='N'?PlayerFacing::NE:PlayerFacing::SE); }
+    else if (left)                   { facing = (g_lastVertical=='N'?PlayerFacing::NW:PlayerFacing::SW); }
+    else                             { facing = g_playerFacing; } // Keep last facing when no input
+
+    // Remember current facing for idle state
+    if (isMoving) {
+        g_playerFacing = facing;
+    }
+
+    // Update player position if moving
+    if (isMoving) {
+        // Move one axis at a time so the player slides along props
+        // blocking the foot rectangle
+        const float maxX = static_cast<float>(worldWidth - updatedSprite.rect.w);
+        const float maxY = static_cast<float>(worldHeight - updatedSprite.rect.h);
+        for (int axis = 0; axis < 2; axis++) {
+            float oldX = updatedSprite.posX, oldY = updatedSprite.posY;
+            SDL_Rect from = updatedSprite.footRect;
+
+            // Update world position, clamped to world boundaries
+            if (axis == 0) updatedSprite.posX = std::clamp(updatedSprite.posX + moveX, 0.0f, maxX);
+            else updatedSprite.posY = std::clamp(updatedSprite.posY + moveY, 0.0f, maxY);
+
+            // Update rect and foot rectangle from the position
+            updatedSprite.syncRects();
+            if (footHash.blocked(from, updatedSprite.footRect)) {
+                updatedSprite.posX = oldX;
+                updatedSprite.posY = oldY;
+                updatedSprite.syncRects();
+            }
+        }
+        spatialGrid.update(playerId, updatedSprite.rect);
+    }
+
+    // Always update animation and facing direction
+    updatedSprite.isMoving = isMoving;
+    
+    // Pick animation based on current state and facing; west-facing
+    // directions reuse the east-facing frames flipped horizontally
+    AnimId animId = g_playerAnims[isMoving ? 1 : 0][static_cast<int>(facing)];
+    SDL_RendererFlip flip = (facing == PlayerFacing::NW || facing == PlayerFacing::SW)
+                            ? SDL_FLIP_HORIZONTAL : SDL_FLIP_NONE;
+
+    // Apply facing flip
+    updatedSprite.facingLeft = (flip == SDL_FLIP_HORIZONTAL);
+
+    // Update animation
+    if (animId != INVALID_ANIM) {
+        auto& A = animations[animId];
+        
+        // Restart the timeline if switching to a new animation
+        if (updatedSprite.currentAnim != animId) {
+            updatedSprite.currentAnim = animId;
+            updatedSprite.animStart = animationClock;
+        }
+
+        // Frame from the player's own timeline, one tick ahead so the first
+        // frame shows for exactly frameDelay
+        int previousFrame = updatedSprite.currentFrame;
+        updatedSprite.currentFrame = A.frameAt(animationClock + deltaTime - updatedSprite.animStart);
+        if (isMoving && updatedSprite.currentFrame != previousFrame && updatedSprite.currentFrame % 2 == 0) {
+            queueSound(footstepSound, updatedSprite.posX + updatedSprite.rect.w / 2.0f,
+                       updatedSprite.posY + updatedSprite.rect.h);
+        }
+        if (!A.frames.empty()) {
+            updatedSprite.currentImage = A.frames[updatedSprite.currentFrame];
+            animationLoader.touch(animId);
+        } else {
+            animationLoader.request(animId);  // Keep the previous image until the frames are loaded
+        }
+
+        // Prefetch what the facing state machine can switch to next: the
+        // other state in this facing, and this state in the neighbouring ones
+        static const PlayerFacing neighbours[6][2] = {
+            {PlayerFacing::NE, PlayerFacing::NW},  // N
+            {PlayerFacing::SE, PlayerFacing::SW},  // S
+            {PlayerFacing::N, PlayerFacing::SE},   // NE
+            {PlayerFacing::S, PlayerFacing::NE},   // SE
+            {PlayerFacing::N, PlayerFacing::SW},   // NW
+            {PlayerFacing::S, PlayerFacing::NW},   // SW
+        };
+        int f = static_cast<int>(facing);
+        animationLoader.prefetch(g_playerAnims[isMoving ? 0 : 1][f]);
+        for (PlayerFacing next : neighbours[f]) animationLoader.prefetch(g_playerAnims[isMoving ? 1 : 0][static_cast<int>(next)]);
+    } else {
+        LOG_RATE_LIMITED(LOG_WARN, "Animation not found for '"
+                                   << g_playerAnimNames[isMoving ? 1 : 0][static_cast<int>(facing)] << "'");
+    }
+
+    debugPlayerAnimation(updatedSprite);
+}
+
+// Center the camera on the player's interpolated position
+void updateCamera() {
+    if (playerId == INVALID_ENTITY) return;
+
+    const GameSprite& currentPlayerSprite = gameSprites[playerId];
+    SDL_FPoint playerPos = interpolatedPosition(currentPlayerSprite);
+    float visibleWidth = SCREEN_WIDTH / globalScale;
+    float visibleHeight = SCREEN_HEIGHT / globalScale;
+    
+    float cameraX = playerPos.x + currentPlayerSprite.rect.w/2.0f - visibleWidth/2.0f;
+    float cameraY = playerPos.y + currentPlayerSprite.rect.h/2.0f - visibleHeight/2.0f;
+    
+    // Clamp camera to world boundaries
+    cameraX = std::max(0.0f, std::min(worldWidth - visibleWidth, cameraX));
+    cameraY = std::max(0.0f, std::min(worldHeight - visibleHeight, cameraY));
+    
+    backgroundOffset.x = -cameraX;
+    backgroundOffset.y = -cameraY;
+}
+
+// NEWLY STABLE 
+
+// Debug output for player animation state
+void debugPlayerAnimation(const GameSprite& sprite) {
+    static NameId lastAnim = INVALID_NAME;
+    NameId currentAnim = sprite.kind;
+    
+    // Print when animation changes
+    if (lastAnim != currentAnim) {
+        LOG(LOG_DEBUG, "Player Animation: " << nameTable[currentAnim]
+                       << (sprite.isMoving ? " (Moving)" : "")
+                       << (sprite.facingLeft ? " (Facing Left)" : "")
+                       << " Frame: " << sprite.currentFrame);
+        lastAnim = currentAnim;
+    }
+}
+
+// Image decode request; filled in by decodeImages()
+struct ImageDecodeJob {
+    std::string path;
+    SDL_Surface* surface = nullptr;
+    std::string error;  // IMG_GetError() text when decoding failed
+};
+
+// Progress of the current asset load, readable from any thread
+struct LoadProgress {
+    std::atomic<size_t> decoded{0};     // Images decoded so far
+    std::atomic<size_t> total{0};       // Images queued for decoding
+    std::atomic<bool> finished{true};   // Set once every image is decoded
+
+    float fraction() const {
+        size_t n = total.load();
+        return n ? static_cast<float>(decoded.load()) / n : 1.0f;
+    }
+};
+LoadProgress loadProgress;
+std::string loadingLabel;  // Shown on the loading screen
+
+// Draw a progress bar for the current load
+void renderLoadingScreen() {
+    SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
+    SDL_RenderClear(renderer);
+
+    const int barW = SCREEN_WIDTH / 2, barH = 16;
+    SDL_Rect frame = {(SCREEN_WIDTH - barW) / 2, SCREEN_HEIGHT / 2, barW, barH};
+    SDL_Rect fill = {frame.x + 2, frame.y + 2, static_cast<int>((barW - 4) * loadProgress.fraction()), barH - 4};
+    SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
+    SDL_RenderDrawRect(renderer, &frame);
+    SDL_RenderFillRect(renderer, &fill);
+
+    std::stringstream ss;
+    ss << "Loading " << loadingLabel << "... " << static_cast<int>(loadProgress.fraction() * 100) << "%";
+    renderText(ss.str(), {255, 255, 255, 255}, frame.x, frame.y - 24);
+    SDL_RenderPresent(renderer);
+}
+
+// Decode images in parallel on the job system. A loader thread drives the
+// jobs while this (render) thread keeps the window alive with a loading
+// screen; textures are created from the surfaces afterwards on this thread.
+void decodeImages(std::vector<ImageDecodeJob>& jobs) {
+    if (jobs.empty()) return;
+    loadProgress.decoded = 0;
+    loadProgress.total = jobs.size();
+    loadProgress.finished = false;
+
+    std::thread loader([&jobs]() {
+        jobSystem.parallelFor(jobs.size(), 1, [&jobs](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) {
+                jobs[i].surface = IMG_Load(jobs[i].path.c_str());
+                if (!jobs[i].surface) jobs[i].error = IMG_GetError();
+                loadProgress.decoded++;
+            }
+        });
+        loadProgress.finished = true;
+    });
+
+    while (renderer && !loadProgress.finished) {
+        // Events stay queued for handleEvents() once the level is up
+        SDL_PumpEvents();
+        renderLoadingScreen();
+        SDL_Delay(16);
+    }
+    loader.join();
+    if (renderer) renderLoadingScreen();
+}
+
+// Animation a map object starts with (its name when it has no mapping)
+std::string initialAnimationName(const std::string& name) {
+    if (name == "aaron") return "aaronIdleS";
+    if (name == "reyna") return "reynaIdleSE";
+    if (name == "mushroom") return "mushroomHop";
+    return name;
+}
+
+// Contents of a text level: decoded images plus everything referring to them.
+// Assets already resident in the cache are listed but not decoded.
+struct LevelSource {
+    struct Texture { std::string name; int image; int footW, footH; bool cached; };
+    struct Animation { animation anim; std::vector<int> frameImages; bool cached; };
+    struct Object { std::string name; std::vector<SDL_Point> positions; };
+
+    std::string name;
+    int worldWidth = MAP_WIDTH, worldHeight = MAP_HEIGHT;  // [WORLD] section
+    std::vector<SDL_Surface*> images;  // Atlas input, owned until packed
+    std::vector<Texture> textures;
+    std::vector<Animation> animations; // Frames are consecutive images
+    std::vector<Object> objects;       // [MAP] lines in file order
+};
+
+// Parse a text map file and decode the images it references, skipping
+// assets resident in the cache when useCache is set
+bool readLevelSource(const std::string& mapFilePath, LevelSource& level, bool useCache) {
+    std::ifstream file(mapFilePath);
+    if (!file.is_open()) {
+        LOG(LOG_ERROR, "Could not open map file: " << mapFilePath);
+        return false;
+    }
+
+    // Extract level name from path
+    std::string levelName;
+    size_t lastSlash = mapFilePath.find_last_of("/\\");
+    if (lastSlash != std::string::npos) {
+        size_t dotPos = mapFilePath.find_last_of('.');
+        levelName = mapFilePath.substr(lastSlash + 1, dotPos - lastSlash - 1);
+    }
+    level.name = levelName;
+
+    // Section parsing state
+    enum class Section { NONE, WORLD, TEXTURES, ANIMATIONS, MAP };
+    Section currentSection = Section::NONE;
+    std::string line;
+
+    // Parsing only queues work: every image is decoded in parallel once the
+    // file has been read
+    std::vector<ImageDecodeJob> decodes;
+    std::vector<std::pair<LevelSource::Texture, size_t>> pendingTextures;  // Texture -> decode index
+    std::vector<std::pair<animation, size_t>> pendingAnimations;           // Animation -> first decode index
+    const size_t NOT_DECODED = std::numeric_limits<size_t>::max();         // On demand or cached
+
+    // Read the file
+    while (std::getline(file, line)) {
+        // Skip empty lines and comments
+        if (line.empty() || line[0] == '#') continue;
+
+        // Section headers
+        if (line == "[WORLD]") currentSection = Section::WORLD;
+        else if (line == "[TEXTURES]") currentSection = Section::TEXTURES;
+        else if (line == "[ANIMATIONS]") currentSection = Section::ANIMATIONS;
+        else if (line == "[MAP]") currentSection = Section::MAP;
+        else {
+            switch (currentSection) {
+                case Section::WORLD: {
+                    // Parse world size: "width height"
+                    std::istringstream iss(line);
+                    int width, height;
+                    if (iss >> width >> height && width > 0 && height > 0) {
+                        level.worldWidth = width;
+                        level.worldHeight = height;
+                    }
+                    break;
+                }
+
+                case Section::TEXTURES: {
+                    // Parse texture line: "name footW footH"
+                    std::istringstream iss(line);
+                    std::string textureName;
+                    int footW, footH;
+                    if (iss >> textureName >> footW >> footH) {
+                        std::string key = textureAssetKey(levelName, textureName);
+                        if (useCache && assetCache.isResident(key)) {
+                            level.textures.push_back({textureName, -1, footW, footH, true});
+                        } else {
+                            pendingTextures.push_back({{textureName, -1, footW, footH, false}, decodes.size()});
+                            decodes.push_back({key, nullptr, {}});
+                        }
+                    }
+                    break;
+                }
+
+                case Section::ANIMATIONS: {
+                    std::istringstream iss(line);
+                    std::string animName;
+                    int frameCount, frameDelay, footW, footH;
+
+                    if (iss >> animName >> frameCount >> frameDelay >> footW >> footH) {
+                        animation anim;
+                        anim.name = animName;
+                        anim.frameCount = frameCount;
+                        anim.frameDelay = frameDelay;
+                        anim.footW = footW;
+                        anim.footH = footH;
+
+                        pendingAnimations.push_back({anim, NOT_DECODED});
+                    }
+                    break;
+                }
+
+                case Section::MAP: {
+                    // Parse object line: "name count x1 y1 x2 y2 ..."
+                    std::istringstream iss(line);
+                    LevelSource::Object object;
+                    int count;
+                    if (iss >> object.name >> count) {
+                        int x, y;
+                        for (int i = 0; i < count && (iss >> x >> y); i++) {
+                            object.positions.push_back({x, y});
+                        }
+                        level.objects.push_back(object);
+                    }
+                    break;
+                }
+
+                case Section::NONE:
+                    break;
+            }
+        }
+    }
+
+    // Queue animation frames once [MAP] is known: when loading for play,
+    // animations no map object starts with are left to load on demand
+    std::unordered_set<std::string> initialAnimations;
+    for (const auto& object : level.objects) initialAnimations.insert(initialAnimationName(object.name));
+    for (auto& [anim, firstDecode] : pendingAnimations) {
+        if (useCache && lazyAnimationsEnabled && !initialAnimations.count(anim.name)) {
+            anim.onDemand = true;
+            level.animations.push_back({anim, {}, false});
+            continue;
+        }
+        if (useCache && assetCache.isResident(animationAssetKey(anim.name, anim.frameCount))) {
+            level.animations.push_back({anim, {}, true});
+            continue;
+        }
+        std::string framePrefix = "assets/animations/" + animationBaseFolder(anim.name) + "/" + anim.name;
+        firstDecode = decodes.size();
+        for (int i = 1; i <= anim.frameCount; i++) {
+            decodes.push_back({framePrefix + std::to_string(i) + ".png", nullptr, {}});
+        }
+    }
+
+    // Decode everything at once
+    loadingLabel = levelName;
+    decodeImages(decodes);
+
+    // Keep the images that decoded; animations need all of their frames
+    for (auto& [texture, index] : pendingTextures) {
+        ImageDecodeJob& job = decodes[index];
+        if (!job.surface) {
+            LOG(LOG_ERROR, "Failed to load texture: " << job.path << " - " << job.error);
+            continue;
+        }
+        texture.image = static_cast<int>(level.images.size());
+        level.images.push_back(job.surface);
+        job.surface = nullptr;
+        level.textures.push_back(texture);
+    }
+    for (auto& [anim, firstDecode] : pendingAnimations) {
+        if (firstDecode == NOT_DECODED) continue;
+        bool loadedAllFrames = true;
+        for (int i = 0; i < anim.frameCount; i++) {
+            const ImageDecodeJob& job = decodes[firstDecode + i];
+            if (!job.surface) {
+                LOG(LOG_ERROR, "Failed to load frame: " << job.path << " - " << job.error);
+                loadedAllFrames = false;
+                break;
+            }
+        }
+        if (!loadedAllFrames) continue;
+
+        LevelSource::Animation loaded = {anim, {}, false};
+        for (int i = 0; i < anim.frameCount; i++) {
+            ImageDecodeJob& job = decodes[firstDecode + i];
+            loaded.frameImages.push_back(static_cast<int>(level.images.size()));
+            level.images.push_back(job.surface);
+            job.surface = nullptr;
+        }
+        level.animations.push_back(loaded);
+    }
+    // Cleanup partial loads
+    for (auto& job : decodes) {
+        if (job.surface) SDL_FreeSurface(job.surface);
+    }
+    return true;
+}
+
+// Add or replace an animation by name and return its ID
+AnimId registerAnimation(const animation& anim) {
+    auto existing = animationMap.find(anim.name);
+    if (existing != animationMap.end()) {
+        animations[existing->second] = anim;
+        return existing->second;
+    }
+    AnimId animId = static_cast<AnimId>(animations.size());
+    animationMap[anim.name] = animId;
+    animations.push_back(anim);
+    return animId;
+}
+
+// Sprite template of a map object name: its initial animation, or its
+// texture when it has no animation. False when neither is loaded.
+bool buildMapTemplate(const std::string& name, GameSprite& sprite) {
+    std::string animName = initialAnimationName(name);
+
+    const AtlasRegion* image = nullptr;
+    bool isAnim = false;
+    int footW = 0, footH = 0;
+
+    // Try to find animation first
+    AnimId animId = INVALID_ANIM;
+    if (animationMap.find(animName) != animationMap.end()) {
+        animId = animationMap[animName];
+        auto& anim = animations[animId];
+        if (!anim.frames.empty()) {
+            image = &anim.frames[0];
+            footW = anim.footW;
+            footH = anim.footH;
+            isAnim = true;
+        }
+    } else if (textureMap.find(name) != textureMap.end()) {
+        image = &textureMap[name];
+        auto& footDims = textureFootMap[name];
+        footW = footDims.x;
+        footH = footDims.y;
+    }
+
+    // Create sprites using original name but initial animation texture
+    if (!image || !image->page) return false;
+    int w = image->src.w;
+    int h = image->src.h;
+    sprite = GameSprite();
+    sprite.rect = {0, 0, w, h};
+    sprite.currentImage = *image;
+    sprite.kind = internName(name);
+    sprite.currentAnim = isAnim ? animId : INVALID_ANIM;  // Store the initial animation
+    sprite.isAnimated = isAnim;
+    sprite.currentFrame = 0;
+    sprite.isMoving = false;
+
+    // Configure foot rectangle
+    sprite.footW = footW;
+    sprite.footH = footH;
+    sprite.footRect = {
+        (w - footW) / 2,  // Center horizontally
+        h - footH,        // Place at bottom
+        footW,
+        footH
+    };
+    return true;
+}
+
+// Add one map object per position from the name's template and return the
+// template's index, or -1 when nothing could be spawned; see addMapObject()
+int spawnMapObjects(const std::string& name, const SDL_Point* positions, size_t count) {
+    GameSprite sprite;
+    if (!buildMapTemplate(name, sprite)) return -1;
+    int templateId = static_cast<int>(mapTemplates.size());
+    mapTemplates.push_back(sprite);
+    for (size_t i = 0; i < count; i++) {
+        addMapObject(templateId, positions[i].x, positions[i].y);
+    }
+    return templateId;
+}
+
+// Resolve player animation IDs once so handleEvents() never looks up names
+void resolvePlayerAnimations() {
+    for (int moving = 0; moving < 2; moving++) {
+        for (int f = 0; f < 6; f++) {
+            auto animIt = animationMap.find(g_playerAnimNames[moving][f]);
+            bool loaded = animIt != animationMap.end() &&
+                          (!animations[animIt->second].frames.empty() || animations[animIt->second].onDemand);
+            g_playerAnims[moving][f] = loaded ? animIt->second : INVALID_ANIM;
+        }
+    }
+}
+
+// Print how long a level took to load
+void reportLevelLoad(const std::string& levelName, size_t imageCount, std::chrono::steady_clock::time_point start) {
+    double loadMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    LOG(LOG_INFO, "Loaded " << levelName << ": " << imageCount << " images, " << animations.size()
+                  << " animations in " << std::fixed << std::setprecision(1) << loadMs << " ms");
+}
+
+// Add an asset to the current level's references unless it already has one
+void holdLevelAsset(int asset) {
+    if (std::find(levelAssets.begin(), levelAssets.end(), asset) == levelAssets.end()) levelAssets.push_back(asset);
+}
+
+// Reference the level's cached assets and register the newly decoded ones
+// (regions from buildAtlas). Assets the current level already holds are not
+// referenced again, so a hot reload can register a level over itself.
+void registerLevelAssets(const LevelSource& level, const std::vector<AtlasRegion>& regions) {
+    auto reference = [](const std::string& key) {
+        auto it = assetCache.lookup.find(key);
+        if (it != assetCache.lookup.end() && assetCache.assets[it->second].resident &&
+            std::find(levelAssets.begin(), levelAssets.end(), it->second) != levelAssets.end()) {
+            return it->second;
+        }
+        int asset = assetCache.acquire(key);
+        if (asset >= 0) levelAssets.push_back(asset);
+        return asset;
+    };
+
+    for (auto& texture : level.textures) {
+        std::string key = textureAssetKey(level.name, texture.name);
+        int asset = -1;
+        if (texture.cached) {
+            asset = reference(key);
+        } else {
+            asset = assetCache.add(key, texture.name, false, {regions[texture.image]});
+            holdLevelAsset(asset);
+        }
+        if (asset < 0) continue;
+        textureMap[texture.name] = assetCache.assets[asset].regions.front();
+        textureFootMap[texture.name] = {texture.footW, texture.footH};  // Store foot dimensions
+    }
+    for (auto& loaded : level.animations) {
+        std::string key = animationAssetKey(loaded.anim.name, loaded.anim.frameCount);
+        if (loaded.anim.onDemand) {
+            // Not held by the level; keep frames still resident from before
+            animation anim = loaded.anim;
+            auto it = assetCache.lookup.find(key);
+            if (it != assetCache.lookup.end() && assetCache.assets[it->second].resident) {
+                anim.frames = assetCache.assets[it->second].regions;
+            }
+            registerAnimation(anim);
+            continue;
+        }
+        int asset = -1;
+        if (loaded.cached) {
+            asset = reference(key);
+        } else {
+            std::vector<AtlasRegion> frames;
+            for (int index : loaded.frameImages) frames.push_back(regions[index]);
+            asset = assetCache.add(key, loaded.anim.name, true, frames);
+            holdLevelAsset(asset);
+        }
+        if (asset < 0) continue;
+        animation anim = loaded.anim;
+        anim.frames = assetCache.assets[asset].regions;
+        registerAnimation(anim);
+    }
+}
+
+// The text level currently loaded, kept for hot reload diffs
+LevelSource loadedLevel;                 // Without images
+std::vector<int> loadedObjectTemplates;  // mapTemplates index per [MAP] line, -1 when nothing spawned
+
+// Load game map from file
+bool loadMapFile(const std::string& mapFilePath) {
+    auto loadStart = std::chrono::steady_clock::now();
+    LevelSource level;
+    if (!readLevelSource(mapFilePath, level, true)) return false;
+    size_t imageCount = level.images.size();
+
+    // Upload atlas pages for the newly decoded images (render thread only)
+    std::vector<SDL_Texture*> pages;
+    std::vector<AtlasRegion> regions = buildAtlas(level.images, pages);
+    for (SDL_Texture* page : pages) assetCache.addPage(page);
+
+    beginWorld(level.worldWidth, level.worldHeight);
+    registerLevelAssets(level, regions);
+
+    // Spawn the map
+    loadedObjectTemplates.clear();
+    for (auto& object : level.objects) {
+        loadedObjectTemplates.push_back(spawnMapObjects(object.name, object.positions.data(), object.positions.size()));
+    }
+    resolvePlayerAnimations();
+
+    // Keep what the file defined for hot reload (the images are freed)
+    level.images.clear();
+    loadedLevel = level;
+    loadedLevelPath = mapFilePath;
+
+    reportLevelLoad(level.name, imageCount, loadStart);
+    return true;
+}
+
+// Baked level bundle (assets/levels/<level>.bundle), written by --bake and
+// mapped straight into memory at load time. All offsets are from the start
+// of the file; records use native byte order and are aligned for direct
+// access. Pixel data is RGBA32 with a pitch of width * 4.
+const char BUNDLE_MAGIC[4] = {'L', 'V', 'L', 'B'};
+const Uint32 BUNDLE_VERSION = 3;  // 3: images aligned to MIP_ALIGN
+
+struct BundleHeader {
+    char magic[4];
+    Uint32 version;
+    Uint32 fileSize;
+    Sint32 worldWidth, worldHeight;
+    Uint32 nameCount, namesOffset, stringsOffset;   // Name table
+    Uint32 pageCount, pagesOffset;                  // Atlas pages
+    Uint32 regionCount, regionsOffset;              // Images within pages
+    Uint32 textureCount, texturesOffset;
+    Uint32 animationCount, animationsOffset;
+    Uint32 objectCount, objectsOffset;              // [MAP] lines
+    Uint32 positionCount, positionsOffset;          // SDL_Point per spawned sprite
+};
+
+struct BundleName { Uint32 offset, length; };       // Characters in the string blob
+struct BundlePage { Uint32 width, height, pixelsOffset; };
+struct BundleRegion { Uint32 page; SDL_Rect src; };
+struct BundleTexture { Uint32 name, region; Sint32 footW, footH; };
+struct BundleAnimation { Uint32 name; Sint32 frameCount, frameDelay, footW, footH; Uint32 firstRegion; };
+struct BundleObject { Uint32 name, positionCount, firstPosition; };
+
+// Read-only view of a whole file, memory-mapped where the platform allows
+struct MappedFile {
+    const unsigned char* data = nullptr;
+    size_t size = 0;
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = nullptr;
+#else
+    int fd = -1;
+#endif
+
+    ~MappedFile() { close(); }
+
+    bool open(const std::string& path) {
+#ifdef _WIN32
+        file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE) return false;
+        LARGE_INTEGER fileSize;
+        if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) return false;
+        mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (!mapping) return false;
+        data = static_cast<const unsigned char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+        size = static_cast<size_t>(fileSize.QuadPart);
+#else
+        fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        struct stat info;
+        if (fstat(fd, &info) != 0 || info.st_size == 0) return false;
+        void* mapped = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapped == MAP_FAILED) return false;
+        data = static_cast<const unsigned char*>(mapped);
+        size = static_cast<size_t>(info.st_size);
+#endif
+        return data != nullptr;
+    }
+
+    void close() {
+#ifdef _WIN32
+        if (data) UnmapViewOfFile(data);
+        if (mapping) CloseHandle(mapping);
+        if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+        mapping = nullptr;
+        file = INVALID_HANDLE_VALUE;
+#else
+        if (data) munmap(const_cast<unsigned char*>(data), size);
+        if (fd >= 0) ::close(fd);
+        fd = -1;
+#endif
+        data = nullptr;
+        size = 0;
+    }
+};
+
+// Append records to a bundle being written, aligned for direct access, and
+// return their offset
+template <typename T>
+Uint32 appendBundleData(std::vector<char>& out, const T* records, size_t count, size_t align = alignof(T)) {
+    out.resize((out.size() + align - 1) / align * align, 0);
+    Uint32 offset = static_cast<Uint32>(out.size());
+    const char* bytes = reinterpret_cast<const char*>(records);
+    out.insert(out.end(), bytes, bytes + count * sizeof(T));
+    return offset;
+}
+
+// Bake a text level and its images into a bundle with pre-packed atlas pages
+bool bakeLevel(const std::string& levelName) {
+    LevelSource level;
+    if (!readLevelSource("assets/levels/" + levelName + ".txt", level, false)) return false;
+    PackedAtlas atlas = packAtlas(level.images);
+    for (SDL_Surface* page : atlas.pages) {
+        if (!page) {
+            for (SDL_Surface* p : atlas.pages) SDL_FreeSurface(p);
+            return false;
+        }
+    }
+
+    // Name table, shared by textures, animations and objects
+    std::vector<BundleName> names;
+    std::string strings;
+    std::unordered_map<std::string, Uint32> nameIndex;
+    auto nameOf = [&](const std::string& name) {
+        auto it = nameIndex.find(name);
+        if (it != nameIndex.end()) return it->second;
+        Uint32 index = static_cast<Uint32>(names.size());
+        names.push_back({static_cast<Uint32>(strings.size()), static_cast<Uint32>(name.size())});
+        strings += name;
+        nameIndex[name] = index;
+        return index;
+    };
+
+    std::vector<BundleRegion> regions;
+    for (auto& slot : atlas.slots) regions.push_back({static_cast<Uint32>(slot.page), slot.src});
+    std::vector<BundleTexture> textures;
+    for (auto& texture : level.textures) {
+        textures.push_back({nameOf(texture.name), static_cast<Uint32>(texture.image), texture.footW, texture.footH});
+    }
+    std::vector<BundleAnimation> bundleAnimations;
+    for (auto& loaded : level.animations) {
+        const animation& anim = loaded.anim;
+        Uint32 first = loaded.frameImages.empty() ? 0 : static_cast<Uint32>(loaded.frameImages.front());
+        bundleAnimations.push_back({nameOf(anim.name), static_cast<Sint32>(loaded.frameImages.size()),
+                                    anim.frameDelay, anim.footW, anim.footH, first});
+    }
+    std::vector<BundleObject> objects;
+    std::vector<SDL_Point> positions;
+    for (auto& object : level.objects) {
+        objects.push_back({nameOf(object.name), static_cast<Uint32>(object.positions.size()),
+                           static_cast<Uint32>(positions.size())});
+        positions.insert(positions.end(), object.positions.begin(), object.positions.end());
+    }
+
+    // Lay out the file
+    BundleHeader header = {};
+    std::memcpy(header.magic, BUNDLE_MAGIC, sizeof(header.magic));
+    header.version = BUNDLE_VERSION;
+    header.worldWidth = level.worldWidth;
+    header.worldHeight = level.worldHeight;
+    std::vector<char> out(sizeof(BundleHeader), 0);
+    header.nameCount = static_cast<Uint32>(names.size());
+    header.namesOffset = appendBundleData(out, names.data(), names.size());
+    header.stringsOffset = appendBundleData(out, strings.data(), strings.size());
+    header.regionCount = static_cast<Uint32>(regions.size());
+    header.regionsOffset = appendBundleData(out, regions.data(), regions.size());
+    header.textureCount = static_cast<Uint32>(textures.size());
+    header.texturesOffset = appendBundleData(out, textures.data(), textures.size());
+    header.animationCount = static_cast<Uint32>(bundleAnimations.size());
+    header.animationsOffset = appendBundleData(out, bundleAnimations.data(), bundleAnimations.size());
+    header.objectCount = static_cast<Uint32>(objects.size());
+    header.objectsOffset = appendBundleData(out, objects.data(), objects.size());
+    header.positionCount = static_cast<Uint32>(positions.size());
+    header.positionsOffset = appendBundleData(out, positions.data(), positions.size());
+
+    // Page pixels go last, each tightly packed and 16-byte aligned
+    std::vector<BundlePage> pages;
+    for (SDL_Surface* page : atlas.pages) {
+        Uint32 pixelsOffset = appendBundleData<char>(out, nullptr, 0, 16);
+        SDL_LockSurface(page);
+        for (int y = 0; y < page->h; y++) {
+            appendBundleData(out, static_cast<const char*>(page->pixels) + y * page->pitch, page->w * 4, 1);
+        }
+        SDL_UnlockSurface(page);
+        pages.push_back({static_cast<Uint32>(page->w), static_cast<Uint32>(page->h), pixelsOffset});
+        SDL_FreeSurface(page);
+    }
+    header.pageCount = static_cast<Uint32>(pages.size());
+    header.pagesOffset = appendBundleData(out, pages.data(), pages.size());
+    header.fileSize = static_cast<Uint32>(out.size());
+    std::memcpy(out.data(), &header, sizeof(header));
+
+    std::string bundlePath = "assets/levels/" + levelName + ".bundle";
+    std::ofstream file(bundlePath, std::ios::binary);
+    if (!file.write(out.data(), out.size())) {
+        LOG(LOG_ERROR, "Could not write bundle: " << bundlePath);
+        return false;
+    }
+    LOG(LOG_INFO, "Baked " << bundlePath << ": " << pages.size() << " pages, " << regions.size()
+                  << " images, " << positions.size() << " sprites, " << out.size() << " bytes");
+    return true;
+}
+
+// Load a baked level bundle. The whole file is validated before anything is
+// created, so a bad bundle leaves the level untouched.
+bool loadBundle(const std::string& bundlePath) {
+    auto loadStart = std::chrono::steady_clock::now();
+    MappedFile file;
+    if (!file.open(bundlePath)) {
+        LOG(LOG_ERROR, "Could not map bundle: " << bundlePath);
+        return false;
+    }
+
+    // Validate the header and every section
+    const BundleHeader* header = reinterpret_cast<const BundleHeader*>(file.data);
+    auto fits = [&](Uint64 offset, Uint64 count, size_t recordSize) {
+        return offset <= file.size && count * recordSize <= file.size - offset;
+    };
+    bool valid = file.size >= sizeof(BundleHeader) &&
+                 std::memcmp(header->magic, BUNDLE_MAGIC, sizeof(BUNDLE_MAGIC)) == 0 &&
+                 header->version == BUNDLE_VERSION && header->fileSize == file.size &&
+                 header->worldWidth > 0 && header->worldHeight > 0 &&
+                 fits(header->namesOffset, header->nameCount, sizeof(BundleName)) &&
+                 fits(header->pagesOffset, header->pageCount, sizeof(BundlePage)) &&
+                 fits(header->regionsOffset, header->regionCount, sizeof(BundleRegion)) &&
+                 fits(header->texturesOffset, header->textureCount, sizeof(BundleTexture)) &&
+                 fits(header->animationsOffset, header->animationCount, sizeof(BundleAnimation)) &&
+                 fits(header->objectsOffset, header->objectCount, sizeof(BundleObject)) &&
+                 fits(header->positionsOffset, header->positionCount, sizeof(SDL_Point));
+    if (!valid) {
+        LOG(LOG_ERROR, "Invalid bundle: " << bundlePath);
+        return false;
+    }
+    const BundleName* names = reinterpret_cast<const BundleName*>(file.data + header->namesOffset);
+    const char* strings = reinterpret_cast<const char*>(file.data + header->stringsOffset);
+    const BundlePage* pages = reinterpret_cast<const BundlePage*>(file.data + header->pagesOffset);
+    const BundleRegion* regions = reinterpret_cast<const BundleRegion*>(file.data + header->regionsOffset);
+    const BundleTexture* textures = reinterpret_cast<const BundleTexture*>(file.data + header->texturesOffset);
+    const BundleAnimation* bundleAnimations = reinterpret_cast<const BundleAnimation*>(file.data + header->animationsOffset);
+    const BundleObject* objects = reinterpret_cast<const BundleObject*>(file.data + header->objectsOffset);
+    const SDL_Point* positions = reinterpret_cast<const SDL_Point*>(file.data + header->positionsOffset);
+
+    for (Uint32 i = 0; valid && i < header->nameCount; i++) {
+        valid = fits(Uint64(header->stringsOffset) + names[i].offset, names[i].length, 1);
+    }
+    for (Uint32 i = 0; valid && i < header->pageCount; i++) {
+        valid = fits(pages[i].pixelsOffset, Uint64(pages[i].width) * pages[i].height, 4);
     }
-    if (state[SDL_SCANCODE_W]) {  // Up
-        moveY -= static_cast<int>(std::round(moveAmount));
-        isMoving = true;
+    for (Uint32 i = 0; valid && i < header->regionCount; i++) {
+        const SDL_Rect& src = regions[i].src;
+        valid = regions[i].page < header->pageCount && src.x >= 0 && src.y >= 0 && src.w >= 0 && src.h >= 0 &&
+                Sint64(src.x) + src.w <= pages[regions[i].page].width &&
+                Sint64(src.y) + src.h <= pages[regions[i].page].height;
     }
-    if (state[SDL_SCANCODE_S]) {  // Down
-        moveY += static_cast<int>(std::round(moveAmount));
-        isMoving = true;
+    for (Uint32 i = 0; valid && i < header->textureCount; i++) {
+        valid = textures[i].name < header->nameCount && textures[i].region < header->regionCount;
+    }
+    for (Uint32 i = 0; valid && i < header->animationCount; i++) {
+        const BundleAnimation& anim = bundleAnimations[i];
+        valid = anim.name < header->nameCount && anim.frameCount >= 0 &&
+                Uint64(anim.firstRegion) + anim.frameCount <= header->regionCount;
+    }
+    for (Uint32 i = 0; valid && i < header->objectCount; i++) {
+        valid = objects[i].name < header->nameCount &&
+                Uint64(objects[i].firstPosition) + objects[i].positionCount <= header->positionCount;
+    }
+    if (!valid) {
+        LOG(LOG_ERROR, "Corrupt bundle: " << bundlePath);
+        return false;
     }
+    auto nameAt = [&](Uint32 index) {
+        return std::string(strings + names[index].offset, names[index].length);
+    };
+    std::string levelName = bundlePath.substr(bundlePath.find_last_of("/\\") + 1);
+    levelName = levelName.substr(0, levelName.find('.'));
 
-    // Determine facing direction
-    bool up    = state[SDL_SCANCODE_W];
-    bool down  = state[SDL_SCANCODE_S];
-    bool left  = state[SDL_SCANCODE_A];
-    bool right = state[SDL_SCANCODE_D];
+    beginWorld(header->worldWidth, header->worldHeight);
 
-    // Track last vertical direction
-    if (up)   g_lastVertical = 'N';
-    if (down) g_lastVertical = 'S';
+    // Only pages holding assets the cache lacks need uploading
+    std::vector<std::string> textureKeys, animationKeys;
+    std::vector<char> pageNeeded(header->pageCount, 0);
+    for (Uint32 i = 0; i < header->textureCount; i++) {
+        textureKeys.push_back(textureAssetKey(levelName, nameAt(textures[i].name)));
+        if (!assetCache.isResident(textureKeys.back())) pageNeeded[regions[textures[i].region].page] = 1;
+    }
+    for (Uint32 i = 0; i < header->animationCount; i++) {
+        const BundleAnimation& baked = bundleAnimations[i];
+        animationKeys.push_back(animationAssetKey(nameAt(baked.name), baked.frameCount));
+        if (assetCache.isResident(animationKeys.back())) continue;
+        for (Sint32 f = 0; f < baked.frameCount; f++) pageNeeded[regions[baked.firstRegion + f].page] = 1;
+    }
 
-    PlayerFacing facing;
-    
-    // Determine facing direction (whether moving or not)
-    if      (up  && !left && !right) { facing = PlayerFacing::N; }
-    else if (down&& !left && !right) { facing = PlayerFacing::S; }
-    else if (up  && right)           { facing = PlayerFacing::NE; }
-    else if (up  && left)            { facing = PlayerFacing::NW; }
-    else if (down&& right)           { facing = PlayerFacing::SE; }
-    else if (down&& left)            { facing = PlayerFacing::SW; }
-    else if (right)                  { facing = (g_lastVertical=='N'?PlayerFacing::NE:PlayerFacing::SE); }
-    else if (left)                   { facing = (g_lastVertical=='N'?PlayerFacing::NW:PlayerFacing::SW); }
-    else                             { facing = g_playerFacing; } // Keep last facing when no input
+    // Upload the pages straight from the mapping
+    std::vector<SDL_Texture*> pageTextures(header->pageCount, nullptr);
+    size_t imageCount = 0;
+    for (Uint32 p = 0; p < header->pageCount; p++) {
+        if (!pageNeeded[p]) continue;
+        SDL_Texture* texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA32, SDL_TEXTUREACCESS_STATIC,
+                                                 pages[p].width, pages[p].height);
+        if (!texture) {
+            LOG(LOG_ERROR, "Failed to create atlas page texture: " << SDL_GetError());
+            continue;
+        }
+        SDL_UpdateTexture(texture, nullptr, file.data + pages[p].pixelsOffset, pages[p].width * 4);
+        SDL_SetTextureBlendMode(texture, SDL_BLENDMODE_BLEND);
+        createTextureMips(texture, file.data + pages[p].pixelsOffset, pages[p].width, pages[p].height, pages[p].width * 4);
+        assetCache.addPage(texture);
+        pageTextures[p] = texture;
+    }
+    std::vector<AtlasRegion> atlas(header->regionCount);
+    for (Uint32 i = 0; i < header->regionCount; i++) {
+        const BundlePage& page = pages[regions[i].page];
+        if (pageTextures[regions[i].page]) {
+            atlas[i] = atlasRegion(pageTextures[regions[i].page], regions[i].src, page.width, page.height);
+            imageCount++;
+        }
+    }
 
-    // Remember current facing for idle state
-    if (isMoving) {
-        g_playerFacing = facing;
+    // Reference cached assets, register the new ones and spawn the map
+    for (Uint32 i = 0; i < header->textureCount; i++) {
+        std::string name = nameAt(textures[i].name);
+        int asset = assetCache.acquire(textureKeys[i]);
+        if (asset < 0) asset = assetCache.add(textureKeys[i], name, false, {atlas[textures[i].region]});
+        levelAssets.push_back(asset);
+        textureMap[name] = assetCache.assets[asset].regions.front();
+        textureFootMap[name] = {textures[i].footW, textures[i].footH};
+    }
+    for (Uint32 i = 0; i < header->animationCount; i++) {
+        const BundleAnimation& baked = bundleAnimations[i];
+        animation anim;
+        anim.name = nameAt(baked.name);
+        anim.frameCount = baked.frameCount;
+        anim.frameDelay = baked.frameDelay;
+        anim.footW = baked.footW;
+        anim.footH = baked.footH;
+        int asset = assetCache.acquire(animationKeys[i]);
+        if (asset < 0) {
+            std::vector<AtlasRegion> frames(atlas.begin() + baked.firstRegion, atlas.begin() + baked.firstRegion + baked.frameCount);
+            asset = assetCache.add(animationKeys[i], anim.name, true, frames);
+        }
+        levelAssets.push_back(asset);
+        anim.frames = assetCache.assets[asset].regions;
+        registerAnimation(anim);
+    }
+    for (Uint32 i = 0; i < header->objectCount; i++) {
+        spawnMapObjects(nameAt(objects[i].name), positions + objects[i].firstPosition, objects[i].positionCount);
     }
+    resolvePlayerAnimations();
 
-    // Update player position if moving
-    if (isMoving) {
-        // Update main rectangle position
-        updatedSprite.rect.x += moveX;
-        updatedSprite.rect.y += moveY;
+    reportLevelLoad(levelName, imageCount, loadStart);
+    return true;
+}
 
-        // Clamp to world boundaries
-        updatedSprite.rect.x = std::max(0, std::min(MAP_WIDTH - updatedSprite.rect.w, updatedSprite.rect.x));
-        updatedSprite.rect.y = std::max(0, std::min(MAP_HEIGHT - updatedSprite.rect.h, updatedSprite.rect.y));
+// Hot reload (--hot-reload): while the game runs, the current text level,
+// its textures and its animation frames are watched. A changed image is
+// decoded and uploaded on its own and swapped in wherever it is shown; a
+// changed level file is parsed again and only its differences are applied.
 
-        // Update foot rectangle position
-        updatedSprite.footRect.x = updatedSprite.rect.x + (updatedSprite.rect.w - updatedSprite.footW) / 2;
-        updatedSprite.footRect.y = updatedSprite.rect.y + updatedSprite.rect.h - updatedSprite.footH;
+// Change notifications for the folders of watched files: inotify on Linux,
+// change notification handles on Windows, and a scan on every poll
+// elsewhere. A notification only triggers the scan; comparing modification
+// times tells which files changed and folds the several events one save
+// produces into one.
+struct FileWatcher {
+    struct WatchedFile {
+        std::string path;
+        std::filesystem::file_time_type modified;
+    };
+    std::vector<WatchedFile> files;
+    std::vector<std::string> folders;
+#if defined(__linux__)
+    int notifyFd = -1;
+#elif defined(_WIN32)
+    std::vector<HANDLE> handles;  // One per folder
+#endif
 
-        // Update camera to follow player
-        int cameraX = updatedSprite.rect.x + updatedSprite.rect.w/2 - SCREEN_WIDTH/2;
-        int cameraY = updatedSprite.rect.y + updatedSprite.rect.h/2 - SCREEN_HEIGHT/2;
+    ~FileWatcher() { clear(); }
 
-        // Clamp camera to world boundaries
-        cameraX = std::max(0, std::min(MAP_WIDTH - SCREEN_WIDTH, cameraX));
-        cameraY = std::max(0, std::min(MAP_HEIGHT - SCREEN_HEIGHT, cameraY));
+    static std::filesystem::file_time_type modifiedTime(const std::string& path) {
+        std::error_code error;
+        auto time = std::filesystem::last_write_time(path, error);
+        return error ? std::filesystem::file_time_type::min() : time;
+    }
 
-        // Set background offset (negative of camera position)
-        backgroundOffset.x = -cameraX;
-        backgroundOffset.y = -cameraY;
-        
-        needsUpdate = true;
+    void watch(const std::string& path) {
+        files.push_back({path, modifiedTime(path)});
+        size_t slash = path.find_last_of("/\\");
+        std::string folder = slash == std::string::npos ? "." : path.substr(0, slash);
+        if (std::find(folders.begin(), folders.end(), folder) != folders.end()) return;
+        folders.push_back(folder);
+#if defined(__linux__)
+        if (notifyFd < 0) notifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (notifyFd >= 0 && inotify_add_watch(notifyFd, folder.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE) < 0) {
+            LOG(LOG_WARN, "Cannot watch " << folder << ": " << std::strerror(errno));
+        }
+#elif defined(_WIN32)
+        HANDLE handle = FindFirstChangeNotificationA(folder.c_str(), FALSE,
+                                                     FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_FILE_NAME);
+        if (handle == INVALID_HANDLE_VALUE) {
+            LOG(LOG_WARN, "Cannot watch " << folder);
+        } else {
+            handles.push_back(handle);
+        }
+#endif
     }
 
-    // Always update animation and facing direction
-    updatedSprite.isMoving = isMoving;
-    
-    // Pick animation name based on current state and facing
-    std::string animName;
-    SDL_RendererFlip flip = SDL_FLIP_NONE;
+    void clear() {
+#if defined(__linux__)
+        if (notifyFd >= 0) ::close(notifyFd);
+        notifyFd = -1;
+#elif defined(_WIN32)
+        for (HANDLE handle : handles) FindCloseChangeNotification(handle);
+        handles.clear();
+#endif
+        files.clear();
+        folders.clear();
+    }
 
-    if (isMoving) {
-        // Walking animations
-        switch (facing) {
-            case PlayerFacing::N:  animName = "aaronWalkN";    break;
-            case PlayerFacing::S:  animName = "aaronWalkS";    break;
-            case PlayerFacing::NE: animName = "aaronWalkNE";   break;
-            case PlayerFacing::NW: animName = "aaronWalkNE"; flip = SDL_FLIP_HORIZONTAL; break;
-            case PlayerFacing::SE: animName = "aaronWalkSE";   break;
-            case PlayerFacing::SW: animName = "aaronWalkSE"; flip = SDL_FLIP_HORIZONTAL; break;
+    // Append the watched files modified since the last poll
+    void poll(std::vector<std::string>& changed) {
+        bool notified = true;
+#if defined(__linux__)
+        if (notifyFd >= 0) {
+            alignas(inotify_event) char events[4096];
+            notified = false;
+            while (read(notifyFd, events, sizeof(events)) > 0) notified = true;
         }
-    } else {
-        // Idle animations
-        switch (facing) {
-            case PlayerFacing::N:  animName = "aaronIdleN";    break;
-            case PlayerFacing::S:  animName = "aaronIdleS";    break;
-            case PlayerFacing::NE: animName = "aaronIdleNE";   break;
-            case PlayerFacing::NW: animName = "aaronIdleNE";  flip = SDL_FLIP_HORIZONTAL; break;
-            case PlayerFacing::SE: animName = "aaronIdleSE";   break;
-            case PlayerFacing::SW: animName = "aaronIdleSE";  flip = SDL_FLIP_HORIZONTAL; break;
+#elif defined(_WIN32)
+        if (!handles.empty()) {
+            notified = false;
+            for (HANDLE handle : handles) {
+                if (WaitForSingleObject(handle, 0) != WAIT_OBJECT_0) continue;
+                notified = true;
+                FindNextChangeNotification(handle);
+            }
+        }
+#endif
+        if (!notified) return;
+        for (WatchedFile& file : files) {
+            auto modified = modifiedTime(file.path);
+            if (modified == file.modified) continue;
+            file.modified = modified;
+            changed.push_back(file.path);
         }
     }
+};
 
-    // Apply facing flip
-    updatedSprite.facingLeft = (flip == SDL_FLIP_HORIZONTAL);
+bool sameRegion(const AtlasRegion& a, const AtlasRegion& b) {
+    return a.page == b.page && a.src.x == b.src.x && a.src.y == b.src.y && a.src.w == b.src.w && a.src.h == b.src.h;
+}
 
-    // Update animation
-    auto animIt = animationMap.find(animName);
-    if (animIt != animationMap.end()) {
-        auto& A = animIt->second;
-        
-        // Reset animation if switching to new one
-        if (updatedSprite.currentAnimName != animName) {
-            updatedSprite.currentAnimName = animName;
-            updatedSprite.currentFrame = 0;
-            updatedSprite.animAccumulator = 0;
-            updatedSprite.currentTexture = A.frames[0];
-            needsUpdate = true;
+// Show an image on a sprite at the same position; the rect takes the image's
+// size and the foot rectangle follows
+void setSpriteImage(GameSprite& sprite, const AtlasRegion& image) {
+    sprite.currentImage = image;
+    sprite.rect.w = image.src.w;
+    sprite.rect.h = image.src.h;
+    sprite.footRect.w = sprite.footW;
+    sprite.footRect.h = sprite.footH;
+    sprite.syncRects();
+}
+
+// Apply fn(sprite, templateId) to every sprite that shows map images: the
+// templates, the entities of built chunks and the live sprites, which are
+// re-indexed and get their static layers redrawn when fn returns true.
+// Records are placed from the templates later, so they need nothing.
+template <typename Fn>
+void updateMapSprites(const Fn& fn) {
+    for (size_t t = 0; t < mapTemplates.size(); t++) fn(mapTemplates[t], static_cast<int>(t));
+    for (int i = 0; i < chunkCols * chunkRows; i++) {
+        for (ChunkEntity& entity : worldChunks[i].entities) fn(entity.sprite, entity.templateId);
+    }
+    for (EntityId id = 0; id < gameSprites.size(); id++) {
+        GameSprite& sprite = gameSprites[id];
+        if (!sprite.alive) continue;
+        SDL_Rect before = sprite.rect;
+        if (!fn(sprite, id < entityTemplates.size() ? entityTemplates[id] : -1)) continue;
+        spatialGrid.update(id, sprite.rect);
+        if (isStaticSprite(sprite)) {
+            markStaticLayers(before);
+            markStaticLayers(sprite.rect);
         }
-        
-        // Always update animation frames (use ms for accumulator)
-        updatedSprite.animAccumulator += deltaTime * 1000.0f; // deltaTime is seconds, convert to ms
-        if (updatedSprite.animAccumulator >= A.frameDelay) {
-            updatedSprite.currentFrame = (updatedSprite.currentFrame + 1) % A.frames.size();
-            updatedSprite.currentTexture = A.frames[updatedSprite.currentFrame];
-            updatedSprite.animAccumulator -= A.frameDelay; // subtract, not reset to 0, for smoothness
-            needsUpdate = true;
+    }
+}
+
+// Upload freshly decoded images as atlas pages owned by the cache and
+// register them under an asset key; false when the upload failed
+bool uploadReloadedAsset(const std::string& key, const std::string& name, bool isAnimation,
+                         std::vector<SDL_Surface*>& images, std::vector<AtlasRegion>& regions) {
+    std::vector<SDL_Texture*> pages;
+    regions = buildAtlas(images, pages);
+    for (SDL_Texture* page : pages) assetCache.addPage(page);
+    for (const AtlasRegion& region : regions) {
+        if (!region.page) return false;
+    }
+    holdLevelAsset(assetCache.add(key, name, isAnimation, regions));
+    return true;
+}
+
+// Reload one texture of the current level from its image file. Its old
+// atlas region stays valid (frames in flight may still draw it); a page left
+// holding nothing else is retired and freed at the next level load.
+bool reloadTextureImage(const std::string& name) {
+    auto current = textureMap.find(name);
+    if (current == textureMap.end()) return false;
+    std::string key = textureAssetKey(loadedLevel.name, name);
+    SDL_Surface* surface = IMG_Load(key.c_str());
+    if (!surface) {
+        LOG(LOG_ERROR, "Failed to reload texture: " << key << " - " << IMG_GetError());
+        return false;
+    }
+    std::vector<SDL_Surface*> images = {surface};
+    std::vector<AtlasRegion> regions;
+    if (!uploadReloadedAsset(key, name, false, images, regions)) return false;
+
+    AtlasRegion old = current->second;
+    current->second = regions.front();
+    updateMapSprites([&](GameSprite& sprite, int) {
+        if (sprite.isAnimated || !sameRegion(sprite.currentImage, old)) return false;
+        setSpriteImage(sprite, regions.front());
+        return true;
+    });
+    return true;
+}
+
+// Reload every frame of one animation from its image files
+bool reloadAnimationImages(const std::string& name) {
+    auto it = animationMap.find(name);
+    if (it == animationMap.end()) return false;
+    AnimId animId = it->second;
+    animation& anim = animations[animId];
+
+    std::string framePrefix = "assets/animations/" + animationBaseFolder(name) + "/" + name;
+    std::vector<SDL_Surface*> images;
+    for (int i = 1; i <= anim.frameCount; i++) {
+        std::string path = framePrefix + std::to_string(i) + ".png";
+        SDL_Surface* surface = IMG_Load(path.c_str());
+        if (!surface) {
+            LOG(LOG_ERROR, "Failed to reload frame: " << path << " - " << IMG_GetError());
+            for (SDL_Surface* image : images) SDL_FreeSurface(image);
+            return false;
         }
-    } else {
-        std::cerr << "Warning: Animation not found for '"<<animName<<"'\n";
+        images.push_back(surface);
     }
+    std::vector<AtlasRegion> regions;
+    if (!uploadReloadedAsset(animationAssetKey(name, anim.frameCount), name, true, images, regions)) return false;
 
-    // Update sprite in container if changed
-    gameSprites.erase(playerSprite);
-    gameSprites.insert(updatedSprite);
-    debugPlayerAnimation(updatedSprite);
+    anim.frames = regions;
+    updateMapSprites([&](GameSprite& sprite, int) {
+        if (sprite.currentAnim != animId) return false;
+        setSpriteImage(sprite, regions.front());
+        sprite.currentImage = regions[std::clamp(sprite.currentFrame, 0, static_cast<int>(regions.size()) - 1)];
+        return true;
+    });
+    return true;
+}
 
-    // Process event queue
-    SDL_Event event;
-    while (SDL_PollEvent(&event)) {
-        switch (event.type) {
-            case SDL_QUIT: 
-                return false;
-            
-            case SDL_MOUSEMOTION:
-                if (cursor) {
-                    cursor->rect.x = event.motion.x;
-                    cursor->rect.y = event.motion.y;
-                }
-                break;
+// Point a map template and its instances at the name's current image and
+// foot size, when a reload changed them
+void refreshMapTemplate(int templateId, const std::string& name) {
+    GameSprite fresh;
+    if (!buildMapTemplate(name, fresh)) return;
+    const GameSprite& tmpl = mapTemplates[templateId];
+    if (sameRegion(tmpl.currentImage, fresh.currentImage) && tmpl.currentAnim == fresh.currentAnim &&
+        tmpl.footW == fresh.footW && tmpl.footH == fresh.footH) {
+        return;
+    }
+    updateMapSprites([&](GameSprite& sprite, int owner) {
+        if (owner != templateId) return false;
+        sprite.currentAnim = fresh.currentAnim;
+        sprite.isAnimated = fresh.isAnimated;
+        sprite.currentFrame = 0;
+        sprite.footW = fresh.footW;
+        sprite.footH = fresh.footH;
+        setSpriteImage(sprite, fresh.currentImage);
+        return true;
+    });
+}
 
-            case SDL_MOUSEBUTTONDOWN:
-                if (event.button.button == SDL_BUTTON_LEFT && cursor) {
-                    // Update cursor position to the click location
-                    cursor->rect.x = event.button.x;
-                    cursor->rect.y = event.button.y;
-
-                    SDL_Point mousePoint = { cursor->rect.x, cursor->rect.y };
-                    bool found = false;
-                    for (auto it = gameSprites.rbegin(); it != gameSprites.rend(); ++it) {
-                        const auto& sprite = *it;
-                        if (sprite.spriteName == "background" || sprite.spriteName == "cursor")
-                            continue;
-
-                        // Apply backgroundOffset and globalScale to get on-screen rect
-                        SDL_Rect adjustedRect = {
-                            static_cast<int>((sprite.rect.x + backgroundOffset.x) * globalScale),
-                            static_cast<int>((sprite.rect.y + backgroundOffset.y) * globalScale),
-                            static_cast<int>(sprite.rect.w * globalScale),
-                            static_cast<int>(sprite.rect.h * globalScale)
-                        };
-
-                        if (SDL_PointInRect(&mousePoint, &adjustedRect)) {
-                            std::cout << "Mouse intersects sprite '" << sprite.spriteName
-                                      << "' rect: {"
-                                      << sprite.rect.x << ", "
-                                      << sprite.rect.y << ", "
-                                      << sprite.rect.w << ", "
-                                      << sprite.rect.h << "}\n";
-                            found = true;
-                            break; // Only print the topmost sprite
-                        }
-                    }
-                    if (!found) {
-                        std::cout << "No sprite under cursor.\n";
-                    }
-                }
-                break;
-            case SDL_MOUSEBUTTONUP:
-                if (event.button.button == SDL_BUTTON_LEFT && cursor) {
-                    // Handle left click release on cursor
-                    std::cout << "Cursor released at: (" << cursor->rect.x << ", " << cursor->rect.y << ")\n";
-                }
-                break;
-                
-            case SDL_KEYDOWN:
-                switch (event.key.keysym.sym) {
-                    case SDLK_LEFT:
-                        PLAYER_SPEED--;
-                        break;
-                    case SDLK_RIGHT:
-                        PLAYER_SPEED++;
-                        break;
-                    case SDLK_UP:
-                        globalScale *= 1.1f;
-                        globalScale = std::min(5.0f, globalScale);
-                        break;
-                    case SDLK_DOWN:
-                        globalScale *= 0.9f;
-                        globalScale = std::max(0.1f, globalScale);
-                        break;
-                }
-                break;
+// Remove the map object of a template placed at pos: the one still standing
+// there, or the nearest one when it has walked off (wandering NPCs)
+bool removeMapObject(int templateId, SDL_Point pos) {
+    const GameSprite& tmpl = mapTemplates[templateId];
+    if (tmpl.kind == kindBackground || tmpl.rect.w > CHUNK_SIZE || tmpl.rect.h > CHUNK_SIZE) {
+        // Persistent objects never move
+        for (EntityId id = 0; id < gameSprites.size(); id++) {
+            const GameSprite& sprite = gameSprites[id];
+            int spriteTemplate = id < entityTemplates.size() ? entityTemplates[id] : -1;
+            if (!sprite.alive || id == playerId || spriteTemplate >= 0 || sprite.kind != tmpl.kind) continue;
+            if (sprite.rect.x == pos.x && sprite.rect.y == pos.y) {
+                despawnSprite(id);
+                return true;
+            }
         }
+        return false;
     }
 
-    // Update camera based on current player position
-    auto currentPlayerSprite = std::find_if(gameSprites.begin(), gameSprites.end(),
-        [](const GameSprite& sprite) { return sprite.spriteName == "aaron"; });
-    
-    if (currentPlayerSprite != gameSprites.end()) {
-        int visibleWidth = static_cast<int>(SCREEN_WIDTH / globalScale);
-        int visibleHeight = static_cast<int>(SCREEN_HEIGHT / globalScale);
-        
-        int cameraX = currentPlayerSprite->rect.x + currentPlayerSprite->rect.w/2 - visibleWidth/2;
-        int cameraY = currentPlayerSprite->rect.y + currentPlayerSprite->rect.h/2 - visibleHeight/2;
-        
-        // Clamp camera to world boundaries
-        cameraX = std::max(0, std::min(MAP_WIDTH - visibleWidth, cameraX));
-        cameraY = std::max(0, std::min(MAP_HEIGHT - visibleHeight, cameraY));
-        
-        backgroundOffset.x = -cameraX;
-        backgroundOffset.y = -cameraY;
+    // Search the placement's chunk first, then everything
+    auto distance = [&](int x, int y) { return Sint64(x - pos.x) * (x - pos.x) + Sint64(y - pos.y) * (y - pos.y); };
+    Sint64 best = std::numeric_limits<Sint64>::max();
+    int bestChunk = -1, bestRecord = -1, bestEntity = -1;
+    EntityId bestLive = INVALID_ENTITY;
+    auto searchChunk = [&](int c) {
+        std::vector<ChunkRecord>& records = worldChunks[c].records;
+        for (size_t r = 0; r < records.size(); r++) {
+            Sint64 d = distance(records[r].pos.x, records[r].pos.y);
+            if (records[r].templateId != templateId || d >= best) continue;
+            best = d;
+            bestChunk = c, bestRecord = static_cast<int>(r), bestEntity = -1, bestLive = INVALID_ENTITY;
+        }
+        std::vector<ChunkEntity>& entities = worldChunks[c].entities;
+        for (size_t e = 0; e < entities.size(); e++) {
+            Sint64 d = distance(entities[e].sprite.rect.x, entities[e].sprite.rect.y);
+            if (entities[e].templateId != templateId || d >= best) continue;
+            best = d;
+            bestChunk = c, bestRecord = -1, bestEntity = static_cast<int>(e), bestLive = INVALID_ENTITY;
+        }
+    };
+    auto searchLive = [&]() {
+        for (EntityId id = 0; id < gameSprites.size(); id++) {
+            if (!gameSprites[id].alive || id == playerId || id >= entityTemplates.size() ||
+                entityTemplates[id] != templateId) continue;
+            Sint64 d = distance(gameSprites[id].rect.x, gameSprites[id].rect.y);
+            if (d >= best) continue;
+            best = d;
+            bestChunk = -1, bestRecord = -1, bestEntity = -1, bestLive = id;
+        }
+    };
+    searchChunk(chunkOf(placeSprite(tmpl, pos.x, pos.y)));
+    if (best != 0) searchLive();
+    for (int c = 0; best != 0 && c < chunkCols * chunkRows; c++) searchChunk(c);
+
+    if (bestRecord >= 0) {
+        std::vector<ChunkRecord>& records = worldChunks[bestChunk].records;
+        records.erase(records.begin() + bestRecord);
+    } else if (bestEntity >= 0) {
+        std::vector<ChunkEntity>& entities = worldChunks[bestChunk].entities;
+        entities.erase(entities.begin() + bestEntity);
+    } else if (bestLive != INVALID_ENTITY) {
+        despawnSprite(bestLive);
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// Apply an edited level file to the running world: new assets are decoded
+// and registered, [MAP] lines are matched to the loaded ones by name and
+// order, and only placements that appeared or disappeared are spawned or
+// removed. A changed world size needs a full load, reported via fullLoad.
+bool reloadLevelFile(bool& fullLoad) {
+    auto start = std::chrono::steady_clock::now();
+    LevelSource level;
+    if (!readLevelSource(loadedLevelPath, level, true)) return false;
+    if (level.worldWidth != worldWidth || level.worldHeight != worldHeight) {
+        for (SDL_Surface* image : level.images) SDL_FreeSurface(image);
+        LOG(LOG_INFO, "World size of " << level.name << " changed, loading it again");
+        fullLoad = true;
+        return loadLevel(level.name);
+    }
+
+    chunkStreamer.flush();
+    std::vector<SDL_Texture*> pages;
+    std::vector<AtlasRegion> regions = buildAtlas(level.images, pages);
+    for (SDL_Texture* page : pages) assetCache.addPage(page);
+    level.images.clear();
+    registerLevelAssets(level, regions);
+
+    auto byPosition = [](const SDL_Point& a, const SDL_Point& b) { return a.x != b.x ? a.x < b.x : a.y < b.y; };
+    std::unordered_map<std::string, std::vector<size_t>> loadedLines;  // Name -> loaded line indices
+    for (size_t i = 0; i < loadedLevel.objects.size(); i++) loadedLines[loadedLevel.objects[i].name].push_back(i);
+    std::unordered_map<std::string, size_t> linesUsed;
+    std::vector<char> kept(loadedLevel.objects.size(), 0);
+    std::vector<int> templates(level.objects.size(), -1);
+    size_t added = 0, removed = 0;
+
+    for (size_t i = 0; i < level.objects.size(); i++) {
+        const LevelSource::Object& object = level.objects[i];
+        const std::vector<size_t>& candidates = loadedLines[object.name];
+        size_t& used = linesUsed[object.name];
+        int templateId = -1;
+        if (used < candidates.size() && loadedObjectTemplates[candidates[used]] >= 0) {
+            kept[candidates[used]] = 1;
+            templateId = loadedObjectTemplates[candidates[used++]];
+        }
+        if (templateId < 0) {
+            templates[i] = spawnMapObjects(object.name, object.positions.data(), object.positions.size());
+            if (templates[i] >= 0) added += object.positions.size();
+            continue;
+        }
+        templates[i] = templateId;
+        refreshMapTemplate(templateId, object.name);
+
+        std::vector<SDL_Point> before = loadedLevel.objects[candidates[used - 1]].positions;
+        std::vector<SDL_Point> after = object.positions;
+        std::sort(before.begin(), before.end(), byPosition);
+        std::sort(after.begin(), after.end(), byPosition);
+        std::vector<SDL_Point> gone, appeared;
+        std::set_difference(before.begin(), before.end(), after.begin(), after.end(), std::back_inserter(gone), byPosition);
+        std::set_difference(after.begin(), after.end(), before.begin(), before.end(), std::back_inserter(appeared), byPosition);
+        for (const SDL_Point& p : gone) removed += removeMapObject(templateId, p);
+        for (const SDL_Point& p : appeared) addMapObject(templateId, p.x, p.y);
+        added += appeared.size();
+    }
+    for (size_t i = 0; i < loadedLevel.objects.size(); i++) {
+        if (kept[i] || loadedObjectTemplates[i] < 0) continue;
+        for (const SDL_Point& p : loadedLevel.objects[i].positions) removed += removeMapObject(loadedObjectTemplates[i], p);
     }
+    resolvePlayerAnimations();
 
+    loadedLevel = level;
+    loadedObjectTemplates = templates;
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    LOG(LOG_INFO, "Reloaded " << level.name << ": " << added << " placements added, " << removed
+                  << " removed in " << std::fixed << std::setprecision(1) << ms << " ms");
     return true;
 }
 
-// NEWLY STABLE 
+// Watches the files of the current text level and applies their changes
+// between frames, while no other thread touches the world
+struct HotReloader {
+    static constexpr double POLL_INTERVAL = 0.25;  // Seconds between checks
 
-// Debug output for player animation state
-void debugPlayerAnimation(const GameSprite& sprite) {
-    static std::string lastAnim = "";
-    std::string currentAnim = sprite.spriteName;
-    
-    // Print when animation changes
-    if (lastAnim != currentAnim) {
-        std::cout << "Player Animation: " << currentAnim;
-        if (sprite.isMoving) std::cout << " (Moving)";
-        if (sprite.facingLeft) std::cout << " (Facing Left)";
-        std::cout << " Frame: " << sprite.currentFrame << std::endl;
-        lastAnim = currentAnim;
+    bool enabled = false;                                          // --hot-reload
+    FileWatcher watcher;
+    std::unordered_map<std::string, std::string> textureFiles;    // Path -> texture name
+    std::unordered_map<std::string, std::string> animationFiles;  // Frame path -> animation name
+    std::vector<std::string> changed;
+    double sincePoll = 0.0;
+
+    // Watch the level file and every image it references
+    void watchLevel() {
+        watcher.clear();
+        textureFiles.clear();
+        animationFiles.clear();
+        if (!enabled) return;
+        if (loadedLevelPath.empty()) {
+            LOG(LOG_WARN, "Hot reload watches text levels only; this level was loaded from a bundle");
+            return;
+        }
+        watcher.watch(loadedLevelPath);
+        for (const auto& texture : loadedLevel.textures) {
+            std::string path = textureAssetKey(loadedLevel.name, texture.name);
+            textureFiles[path] = texture.name;
+            watcher.watch(path);
+        }
+        for (const auto& loaded : loadedLevel.animations) {
+            const std::string& name = loaded.anim.name;
+            std::string framePrefix = "assets/animations/" + animationBaseFolder(name) + "/" + name;
+            for (int i = 1; i <= loaded.anim.frameCount; i++) {
+                std::string path = framePrefix + std::to_string(i) + ".png";
+                animationFiles[path] = name;
+                watcher.watch(path);
+            }
+        }
+        LOG(LOG_INFO, "Hot reload watching " << watcher.files.size() << " files in "
+                      << watcher.folders.size() << " folders");
     }
+
+    // Poll and apply changes; true when the level was loaded from scratch, so
+    // frames recorded before may refer to freed textures
+    bool update(double elapsed) {
+        if (!enabled || (sincePoll += elapsed) < POLL_INTERVAL) return false;
+        sincePoll = 0.0;
+        changed.clear();
+        watcher.poll(changed);
+        if (changed.empty()) return false;
+        allocationCheck.exemptFrame();
+
+        // Reloads rewrite mapTemplates and chunk entities, which the
+        // streaming thread reads and fills while building a chunk
+        chunkStreamer.flush();
+
+        // Images first, so a level edit that comes with them spawns them
+        bool levelChanged = false;
+        std::vector<std::string> reloadedAnimations;
+        for (const std::string& path : changed) {
+            auto start = std::chrono::steady_clock::now();
+            bool reloaded = false;
+            if (path == loadedLevelPath) {
+                levelChanged = true;
+                continue;
+            } else if (auto texture = textureFiles.find(path); texture != textureFiles.end()) {
+                reloaded = reloadTextureImage(texture->second);
+            } else if (auto anim = animationFiles.find(path); anim != animationFiles.end()) {
+                if (std::find(reloadedAnimations.begin(), reloadedAnimations.end(), anim->second) != reloadedAnimations.end()) continue;
+                reloadedAnimations.push_back(anim->second);
+                reloaded = reloadAnimationImages(anim->second);
+            }
+            if (reloaded) {
+                double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+                LOG(LOG_INFO, "Reloaded " << path << " in " << std::fixed << std::setprecision(1) << ms << " ms");
+            }
+        }
+        bool fullLoad = false;
+        if (levelChanged && reloadLevelFile(fullLoad)) watchLevel();
+        return fullLoad;
+    }
+};
+
+HotReloader hotReloader;
+
+// Sprite draw recorded by the simulation and replayed by the render stage
+struct RenderCommand {
+    AtlasRegion image;       // Atlas page and source rect
+    SDL_FRect dst;           // World units relative to the camera (or to the layer origin)
+    bool flipX;              // Mirror horizontally
+    int depth;               // Depth key (foot bottom); commands are recorded in depth order
+};
+
+// Static sprites of one chunk, pre-composited at the current scale into a
+// render target that the render stage keeps between frames. The target is
+// only redrawn when the simulation marks the chunk's layer for a rebuild.
+struct StaticLayerDraw {
+    int chunk;               // Chunk index; the render stage caches one texture per chunk
+    SDL_FRect dst;           // Whole layer texture, in world units relative to the camera
+    int w, h;                // Layer texture size in pixels
+    float scale;             // Scale the layer is composited at; below the frame's when clamped to maxStaticLayerSize
+    bool rebuild;            // Composite the layer's commands into the texture first
+    size_t first, count;     // Commands in RenderFrame::layerSprites, relative to the layer
+};
+
+// Everything the render stage needs to draw one frame
+struct RenderFrame {
+    float scale = 1.0f;                       // View transform from world units to pixels
+    std::vector<StaticLayerDraw> layers;      // On-screen static layers, drawn first
+    std::vector<RenderCommand> layerSprites;  // Contents of the layers being rebuilt
+    std::vector<RenderCommand> sprites;       // Visible sprites not covered by a layer, back to front
+    std::vector<SoundCommand> sounds;         // Sounds to start when the frame is shown
+};
+
+// Double-buffered frames: the render stage draws renderFrames[renderFront]
+// while the simulation records the next frame into the other buffer
+RenderFrame renderFrames[2];
+int renderFront = 0;
+
+// Static layer caching
+const int STATIC_LAYER_COVER_CELL = 32;   // World cell size when tracking what is drawn over the layers
+std::vector<Uint8> layerCoverage;         // Cells of the view already drawn over this frame
+std::vector<EntityId> layerScratch;       // Static sprites of a layer being rebuilt
+std::vector<int> listedLayers;            // Chunks whose layers the last frame recorded
+std::vector<int> failedLayers;            // Chunks whose layer textures could not be created, by the render stage
+
+// Render-stage textures of the static layers, by chunk index
+struct StaticLayerTexture {
+    SDL_Texture* texture = nullptr;
+    int w = 0, h = 0;
+};
+std::unordered_map<int, StaticLayerTexture> staticLayerTextures;
+
+// Depth key of a sprite, matching GameSprite::operator<
+int depthKey(const GameSprite& sprite) {
+    if (sprite.kind == kindBackground) return std::numeric_limits<int>::min();
+    return sprite.footRect.y + sprite.footRect.h;
 }
 
-// Load game map from file
-bool loadMapFile(const std::string& mapFilePath) {
-    std::ifstream file(mapFilePath);
-    if (!file.is_open()) {
-        std::cerr << "Could not open map file: " << mapFilePath << std::endl;
-        return false;
+// Record a sprite at its interpolated position relative to origin; scaling
+// is left to the frame's view transform
+void recordSprite(std::vector<RenderCommand>& out, const GameSprite& sprite, SDL_FPoint origin) {
+    SDL_FPoint pos = interpolatedPosition(sprite);
+    SDL_FRect dst = {pos.x - origin.x, pos.y - origin.y,
+                     static_cast<float>(sprite.rect.w), static_cast<float>(sprite.rect.h)};
+    out.push_back({sprite.currentImage, dst, sprite.facingLeft, depthKey(sprite)});
+}
+
+// Drop every static layer held by the render stage, e.g. after the
+// renderer lost its render targets; the next frame rebuilds them
+void invalidateStaticLayers() {
+    if (!worldChunks) return;
+    for (int i = 0; i < chunkCols * chunkRows; i++) worldChunks[i].layerSent = 0;
+}
+
+// Rebuild the layers the render stage failed to create (between frames)
+void resendFailedLayers() {
+    for (int index : failedLayers) {
+        if (worldChunks && index < chunkCols * chunkRows) worldChunks[index].layerSent = 0;
     }
+    failedLayers.clear();
+}
 
-    // Extract level name from path
-    std::string levelName;
-    size_t lastSlash = mapFilePath.find_last_of("/\\");
-    if (lastSlash != std::string::npos) {
-        size_t dotPos = mapFilePath.find_last_of('.');
-        levelName = mapFilePath.substr(lastSlash + 1, dotPos - lastSlash - 1);
+// Forget the layers of the outgoing world and free their textures (between
+// frames, before the chunks are replaced)
+void clearStaticLayers() {
+    listedLayers.clear();
+    failedLayers.clear();
+    for (auto& [chunk, layer] : staticLayerTextures) {
+        if (layer.texture) SDL_DestroyTexture(layer.texture);
     }
+    staticLayerTextures.clear();
+}
 
-    // Section parsing state
-    enum class Section { NONE, TEXTURES, ANIMATIONS, MAP };
-    Section currentSection = Section::NONE;
-    std::string line;
-    std::string texturesPath = "assets/textures/" + levelName + "/";
-    std::string animationsPath = "assets/animations/";
+// Record the static layers of the chunks on screen, with the contents of
+// those whose static sprites or scale changed since they were last sent
+void recordStaticLayers(RenderFrame& frame) {
+    size_t previousCount = listedLayers.size();
+    int* previous = simulationArena.allocArray<int>(previousCount);
+    for (size_t i = 0; i < previousCount; i++) {
+        previous[i] = listedLayers[i];
+        worldChunks[previous[i]].layerListed = false;
+    }
+    listedLayers.clear();
 
-    // Process each line of map file
-    while (std::getline(file, line)) {
-        // Skip empty lines and comments
-        if (line.empty() || line[0] == '#') continue;
+    SDL_Rect range = chunkRangeAroundView(0);
+    int size = static_cast<int>(std::ceil(CHUNK_SIZE * globalScale));
+    float scale = globalScale;
+    if (maxStaticLayerSize > 0 && size > maxStaticLayerSize) {
+        // Zoomed in past the texture limit: composite at a lower scale
+        size = maxStaticLayerSize;
+        scale = static_cast<float>(size) / CHUNK_SIZE;
+    }
+    float extent = size / scale;  // Layer edge in world units, covering whole pixels
+    for (int y = range.y; y < range.y + range.h; y++) {
+        for (int x = range.x; x < range.x + range.w; x++) {
+            int index = y * chunkCols + x;
+            WorldChunk& chunk = worldChunks[index];
+            SDL_FPoint origin = {static_cast<float>(x * CHUNK_SIZE), static_cast<float>(y * CHUNK_SIZE)};
 
-        // Section headers
-        if (line == "[TEXTURES]") currentSection = Section::TEXTURES;
-        else if (line == "[ANIMATIONS]") currentSection = Section::ANIMATIONS;
-        else if (line == "[MAP]") currentSection = Section::MAP;
-        else {
-            switch (currentSection) {
-                case Section::TEXTURES: {
-                    // Parse texture line: "name footW footH"
-                    std::istringstream iss(line);
-                    std::string textureName;
-                    int footW, footH;
-                    if (iss >> textureName >> footW >> footH) {
-                        std::string texturePath = texturesPath + textureName + ".png";
-                        SDL_Surface* surface = IMG_Load(texturePath.c_str());
-                        if (!surface) {
-                            std::cerr << "Failed to load texture: " << texturePath << std::endl;
-                            continue;
-                        }
-                        // Create texture and store
-                        SDL_Texture* texture = SDL_CreateTextureFromSurface(renderer, surface);
-                        textureMap[textureName] = texture;
-                        textureFootMap[textureName] = {footW, footH};  // Store foot dimensions
-                        SDL_FreeSurface(surface);
-                    }
-                    break;
-                }
+            StaticLayerDraw layer = {index,
+                                     {origin.x + backgroundOffset.x, origin.y + backgroundOffset.y, extent, extent},
+                                     size, size, scale, false, frame.layerSprites.size(), 0};
+            if (chunk.layerSent != chunk.layerVersion || chunk.layerSentScale != globalScale) {
+                SDL_Rect area = {x * CHUNK_SIZE, y * CHUNK_SIZE, CHUNK_SIZE, CHUNK_SIZE};
+                spatialGrid.query(area, gameSprites, layerScratch);
+                layerScratch.erase(std::remove_if(layerScratch.begin(), layerScratch.end(),
+                                                  [](EntityId id) { return !isStaticSprite(gameSprites[id]); }),
+                                   layerScratch.end());
+                std::sort(layerScratch.begin(), layerScratch.end(),
+                          [](EntityId a, EntityId b) { return gameSprites[a] < gameSprites[b]; });
+                for (EntityId id : layerScratch) recordSprite(frame.layerSprites, gameSprites[id], origin);
+                layer.rebuild = true;
+                layer.count = frame.layerSprites.size() - layer.first;
+                chunk.layerSent = chunk.layerVersion;
+                chunk.layerSentScale = globalScale;
+            }
+            frame.layers.push_back(layer);
+            chunk.layerListed = true;
+            listedLayers.push_back(index);
+        }
+    }
 
-                case Section::ANIMATIONS: {
-                    std::istringstream iss(line);
-                    std::string animName;
-                    int frameCount, frameDelay, footW, footH;
-                    
-                    if (iss >> animName >> frameCount >> frameDelay >> footW >> footH) {
-                        animation anim;
-                        anim.name = animName;
-                        anim.frameCount = frameCount;
-                        anim.currentFrame = 0;
-                        anim.frameDelay = frameDelay;
-                        anim.footW = footW;
-                        anim.footH = footH;
-                        
-                        // Extract base folder name (everything before first capital letter)
-                        std::string baseFolder = animName;
-                        size_t firstCap = 0;
-                        while (firstCap < baseFolder.length() && !isupper(baseFolder[firstCap])) {
-                            firstCap++;
-                        }
-                        baseFolder = baseFolder.substr(0, firstCap);  // "aaron" or "mushroom"
-                        
-                        // Load all frames
-                        bool loadedAllFrames = true;
-                        for (int i = 1; i <= frameCount; i++) {
-                            std::string framePath = animationsPath + baseFolder + "/" + animName + std::to_string(i) + ".png";
-                            std::cout << "Loading: " << framePath << std::endl;  // Debug output
-                            
-                            SDL_Surface* surface = IMG_Load(framePath.c_str());
-                            if (!surface) {
-                                std::cerr << "Failed to load frame: " << framePath << " - " << IMG_GetError() << std::endl;
-                                loadedAllFrames = false;
-                                break;
-                            }
-                            
-                            SDL_Texture* texture = SDL_CreateTextureFromSurface(renderer, surface);
-                            SDL_FreeSurface(surface);
-                            
-                            if (!texture) {
-                                std::cerr << "Failed to create texture: " << SDL_GetError() << std::endl;
-                                loadedAllFrames = false;
-                                break;
-                            }
-                            
-                            anim.frames.push_back(texture);
-                        }
-                        
-                        if (loadedAllFrames) {
-                            animationMap[animName] = anim;
-                            std::cout << "Successfully loaded animation: " << animName << std::endl;  // Debug output
-                        } else {
-                            // Cleanup partial loads
-                            for (auto* tex : anim.frames) {
-                                SDL_DestroyTexture(tex);
-                            }
-                        }
-                    }
-                    break;
-                }
+    // The render stage frees layers that are not listed, so they must be
+    // rebuilt when they come back on screen
+    for (size_t i = 0; i < previousCount; i++) {
+        if (!worldChunks[previous[i]].layerListed) worldChunks[previous[i]].layerSent = 0;
+    }
+}
 
-                case Section::MAP: {
-                    std::istringstream iss(line);
-                    std::string name;
-                    int count;
-                    if (iss >> name >> count) {
-                        // Map base names to initial animations
-                        std::string animName = name;
-                        if (name == "aaron") animName = "aaronIdleS";
-                        else if(name == "reyna") animName = "reynaIdleSE";
-                        else if (name == "mushroom") animName = "mushroomHop";
-
-                    
-
-                        SDL_Texture* texture = nullptr;
-                        bool isAnim = false;
-                        int w = 0, h = 0;
-                        int footW = 0, footH = 0;
-
-                        // Try to find animation first
-                        if (animationMap.find(animName) != animationMap.end()) {
-                            auto& anim = animationMap[animName];
-                            if (!anim.frames.empty()) {
-                                texture = anim.frames[0];
-                                footW = anim.footW;
-                                footH = anim.footH;
-                                isAnim = true;
-                            }
-                        } else if (textureMap.find(name) != textureMap.end()) {
-                            texture = textureMap[name];
-                            auto& footDims = textureFootMap[name];
-                            footW = footDims.x;
-                            footH = footDims.y;
-                        }
+// Record the visible sprites in depth order, relative to the camera.
+// With static layers, static sprites are left to the layers unless something
+// drawn over the layers this frame covers part of them: walking back to
+// front, a static sprite is redrawn when any view cell it touches has
+// already been drawn over, which keeps it in front of what stands behind it.
+void recordRenderCommands(RenderFrame& frame) {
+    frame.scale = globalScale;
+    frame.layers.clear();
+    frame.layerSprites.clear();
+    frame.sprites.clear();
+    frame.sprites.reserve(gameSprites.size());  // Grows only when entities spawn
+    SDL_FPoint camera = {-backgroundOffset.x, -backgroundOffset.y};
+    if (!staticLayersEnabled || !worldChunks) {
+        for (EntityId id : drawOrder) recordSprite(frame.sprites, gameSprites[id], camera);
+        return;
+    }
+    recordStaticLayers(frame);
+
+    SDL_Rect view = cameraWorldRect();
+    int cols = view.w / STATIC_LAYER_COVER_CELL + 2;
+    int rows = view.h / STATIC_LAYER_COVER_CELL + 2;
+    layerCoverage.assign(size_t(cols) * rows, 0);
+    auto cells = [&](const SDL_Rect& r, int& x0, int& y0, int& x1, int& y1) {
+        x0 = std::clamp((r.x - view.x) / STATIC_LAYER_COVER_CELL, 0, cols - 1);
+        y0 = std::clamp((r.y - view.y) / STATIC_LAYER_COVER_CELL, 0, rows - 1);
+        x1 = std::clamp((r.x + r.w - 1 - view.x) / STATIC_LAYER_COVER_CELL, 0, cols - 1);
+        y1 = std::clamp((r.y + r.h - 1 - view.y) / STATIC_LAYER_COVER_CELL, 0, rows - 1);
+    };
+
+    for (EntityId id : drawOrder) {
+        const GameSprite& sprite = gameSprites[id];
+        int x0, y0, x1, y1;
+        cells(sprite.rect, x0, y0, x1, y1);
+        if (isStaticSprite(sprite)) {
+            bool covered = false;
+            for (int y = y0; y <= y1 && !covered; y++) {
+                for (int x = x0; x <= x1 && !covered; x++) covered = layerCoverage[y * cols + x] != 0;
+            }
+            if (!covered) continue;
+        }
+        for (int y = y0; y <= y1; y++) {
+            std::fill_n(layerCoverage.begin() + y * cols + x0, x1 - x0 + 1, Uint8(1));
+        }
+        recordSprite(frame.sprites, sprite, camera);
+    }
+}
+
+// Draw recorded commands with the selected backend. The batched backend
+// submits one SDL_RenderGeometry call per run of commands sharing an atlas
+// page; the copy backend issues one SDL_RenderCopyExF per command. Images
+// are taken from mip level mipLevel of their page where it has one.
+void drawCommands(const RenderCommand* commands, size_t count, int mipLevel) {
+    // The level chain is looked up once per page switch
+    SDL_Texture* page = nullptr;
+    const TextureMips* mips = nullptr;
+    auto imageOf = [&](const RenderCommand& cmd) {
+        if (cmd.image.page != page) {
+            page = cmd.image.page;
+            auto it = mipLevel > 0 ? textureMips.find(page) : textureMips.end();
+            mips = it != textureMips.end() ? &it->second : nullptr;
+        }
+        return mips ? mipRegion(cmd.image, *mips, mipLevel) : cmd.image;
+    };
+
+    if (spriteBackend == SPRITE_BACKEND_COPY) {
+        SDL_Texture* boundPage = nullptr;
+        for (size_t i = 0; i < count; i++) {
+            const RenderCommand& cmd = commands[i];
+            AtlasRegion image = imageOf(cmd);
+            if (image.page != boundPage) {
+                boundPage = image.page;
+                profiler.count(COUNTER_TEXTURE_SWITCHES);
+            }
+            SDL_RenderCopyExF(renderer, image.page, &image.src, &cmd.dst, 0.0, nullptr,
+                              cmd.flipX ? SDL_FLIP_HORIZONTAL : SDL_FLIP_NONE);
+            profiler.count(COUNTER_DRAW_CALLS);
+        }
+        return;
+    }
+
+    SDL_Texture* batchPage = nullptr;
+    for (size_t i = 0; i < count; i++) {
+        const RenderCommand& cmd = commands[i];
+        AtlasRegion image = imageOf(cmd);
+        if (image.page != batchPage) {
+            flushSpriteBatch(batchPage);
+            batchPage = image.page;
+            profiler.count(COUNTER_TEXTURE_SWITCHES);
+        }
+        appendSpriteQuad(image, cmd.dst, cmd.flipX);
+    }
+    flushSpriteBatch(batchPage);
+}
 
-                        // Create sprites using original name but initial animation texture
-                        if (texture && SDL_QueryTexture(texture, nullptr, nullptr, &w, &h) == 0) {
-                            for (int i = 0; i < count; i++) {
-                                int x, y;
-                                if (iss >> x >> y) {
-                                    GameSprite sprite;
-                                    sprite.rect = {x, y, w, h};
-                                    sprite.currentTexture = texture;
-                                    sprite.spriteName = name;
-                                    sprite.currentAnimName = animName;  // Store the initial animation name
-                                    sprite.isAnimated = isAnim;
-                                    sprite.currentFrame = 0;
-                                    sprite.isMoving = false;
-                                    
-                                    // Configure foot rectangle
-                                    sprite.footW = footW;
-                                    sprite.footH = footH;
-                                    sprite.footRect = {
-                                        x + (w - footW) / 2,  // Center horizontally
-                                        y + h - footH,        // Place at bottom
-                                        footW,
-                                        footH
-                                    };
-                                    
-                                    // Add to game world
-                                    gameSprites.insert(sprite);
-                                }
-                            }
-                        }
-                    }
-                    break;
+// Rebuild the layer textures the frame asks for, draw the on-screen layers
+// and free the textures of layers that went off screen
+void drawStaticLayers(const RenderFrame& frame) {
+    for (const StaticLayerDraw& layer : frame.layers) {
+        if (layer.rebuild) allocationCheck.exemptFrame();  // New layers take a cache entry
+        StaticLayerTexture& cached = staticLayerTextures[layer.chunk];
+        if (layer.rebuild) {
+            if (cached.texture && (cached.w != layer.w || cached.h != layer.h)) {
+                SDL_DestroyTexture(cached.texture);
+                cached.texture = nullptr;
+            }
+            if (!cached.texture) {
+                cached.texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA8888,
+                                                   SDL_TEXTUREACCESS_TARGET, layer.w, layer.h);
+                if (!cached.texture) {
+                    // Not held, so the simulation must send the layer again
+                    LOG(LOG_ERROR, "Failed to create static layer: " << SDL_GetError());
+                    failedLayers.push_back(layer.chunk);
+                    continue;
                 }
-                
-                case Section::NONE:
-                    break;
+                SDL_SetTextureBlendMode(cached.texture, SDL_BLENDMODE_BLEND);
+                cached.w = layer.w;
+                cached.h = layer.h;
             }
+            SDL_SetRenderTarget(renderer, cached.texture);
+            SDL_RenderSetScale(renderer, layer.scale, layer.scale);
+            SDL_SetRenderDrawColor(renderer, 0, 0, 0, 0);
+            SDL_RenderClear(renderer);
+            drawCommands(frame.layerSprites.data() + layer.first, layer.count, mipLevelFor(layer.scale));
+            SDL_SetRenderTarget(renderer, nullptr);
+            SDL_RenderSetScale(renderer, frame.scale, frame.scale);
+        }
+        if (cached.texture) {
+            SDL_RenderCopyF(renderer, cached.texture, nullptr, &layer.dst);
+            profiler.count(COUNTER_DRAW_CALLS);
+            profiler.count(COUNTER_TEXTURE_SWITCHES);
         }
     }
 
-    return true;
+    for (auto it = staticLayerTextures.begin(); it != staticLayerTextures.end();) {
+        bool listed = std::any_of(frame.layers.begin(), frame.layers.end(),
+                                  [&](const StaticLayerDraw& layer) { return layer.chunk == it->first; });
+        if (listed) {
+            ++it;
+        } else {
+            if (it->second.texture) SDL_DestroyTexture(it->second.texture);
+            it = staticLayerTextures.erase(it);
+        }
+    }
 }
 
-// Render game frame
-void render() {
+// Draw the profiler overlay: recent frame times as a bar graph, min/avg/p99
+// of the frame and of each phase, and the last frame's counters
+void renderProfilerOverlay() {
+    const int x = 10, graphY = 36, graphH = 60, barW = 2, lineH = 18;
+    const size_t bars = std::min<size_t>(profiler.historyCount(), 200);
+    const double budgetMs = 1000.0 / 60.0;
+    const int lines = 2 + ZONE_COUNT;
+
+    SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_BLEND);
+    SDL_SetRenderDrawColor(renderer, 0, 0, 0, 170);
+    SDL_Rect panel = {x - 4, graphY - 4, 200 * barW + 8, graphH + 12 + lines * lineH};
+    SDL_RenderFillRect(renderer, &panel);
+
+    // Bars scale so two 60 Hz frames fill the graph; slow frames turn red
+    for (size_t i = 0; i < bars; i++) {
+        double ms = profiler.recent(i).frameMs;
+        int h = std::min(graphH, static_cast<int>(ms / (2.0 * budgetMs) * graphH));
+        SDL_Rect bar = {x + static_cast<int>(bars - 1 - i) * barW, graphY + graphH - h, barW, h};
+        if (ms <= budgetMs * 1.05) SDL_SetRenderDrawColor(renderer, 80, 220, 80, 255);
+        else if (ms <= budgetMs * 2.0) SDL_SetRenderDrawColor(renderer, 230, 200, 60, 255);
+        else SDL_SetRenderDrawColor(renderer, 230, 70, 60, 255);
+        SDL_RenderFillRect(renderer, &bar);
+    }
+    SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_NONE);
+
+    const SDL_Color white = {255, 255, 255, 255};
+    int y = graphY + graphH + 6;
+    double min, avg, p99;
+    const size_t lineSize = 128;
+    char* line = renderArena.allocArray<char>(lineSize);
+    profiler.summarize([](const FrameProfiler::FrameStats& f) { return f.frameMs; }, min, avg, p99);
+    snprintf(line, lineSize, "frame  min %.2f  avg %.2f  p99 %.2f ms", min, avg, p99);
+    renderText(line, white, x, y);
+    y += lineH;
+
+    for (int z = 0; z < ZONE_COUNT; z++) {
+        profiler.summarize([z](const FrameProfiler::FrameStats& f) { return f.zoneMs[z]; }, min, avg, p99);
+        snprintf(line, lineSize, "%s  avg %.2f  p99 %.2f ms", zoneNames[z], avg, p99);
+        renderText(line, white, x, y);
+        y += lineH;
+    }
+
+    if (profiler.historyCount() > 0) {
+        const FrameProfiler::FrameStats& last = profiler.recent(0);
+        int length = 0;
+        for (int c = 0; c < COUNTER_COUNT; c++) {
+            length += snprintf(line + length, lineSize - length, "%s %llu  ", counterNames[c],
+                               static_cast<unsigned long long>(last.counters[c]));
+            length = std::min(length, static_cast<int>(lineSize) - 1);
+        }
+        snprintf(line + length, lineSize - length, "allocations %llu",
+                 static_cast<unsigned long long>(last.allocations));
+        renderText(line, white, x, y);
+    }
+}
+
+// Render a recorded frame. Only reads the frame, the cursor and the font, so
+// it runs on the main thread while the next frame is being simulated.
+void render(const RenderFrame& frame) {
+    renderArena.reset();
+
     // Clear screen
     SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
     SDL_RenderClear(renderer);
 
-    // Render all sprites with scaling and camera offset
-    for (const auto& sprite : gameSprites) {
-        SDL_Rect adjustedRect = {
-            static_cast<int>((sprite.rect.x + backgroundOffset.x) * globalScale),
-            static_cast<int>((sprite.rect.y + backgroundOffset.y) * globalScale),
-            static_cast<int>(sprite.rect.w * globalScale),
-            static_cast<int>(sprite.rect.h * globalScale)
-        };
-        
-        // Apply horizontal flip if needed
-        SDL_RendererFlip flip = sprite.facingLeft ? SDL_FLIP_HORIZONTAL : SDL_FLIP_NONE;
-        SDL_RenderCopyEx(renderer, sprite.currentTexture, NULL, &adjustedRect, 0, NULL, flip);
+    // World-space commands are scaled by the renderer as one view transform
+    SDL_RenderSetScale(renderer, frame.scale, frame.scale);
+    {
+        ProfileScope scope(ZONE_LAYERS);
+        drawStaticLayers(frame);
     }
+    {
+        ProfileScope scope(ZONE_SPRITES);
+        drawCommands(frame.sprites.data(), frame.sprites.size(), mipLevelFor(frame.scale));
+        SDL_RenderSetScale(renderer, 1.0f, 1.0f);
 
-    // Render cursor (unscaled)
-    if (cursor) {
-        SDL_RenderCopy(renderer, cursor->currentTexture, NULL, &cursor->rect);
+        // Render cursor (unscaled)
+        if (cursor) {
+            SDL_RenderCopy(renderer, cursor->currentImage.page, NULL, &cursor->rect);
+            profiler.count(COUNTER_DRAW_CALLS);
+            profiler.count(COUNTER_TEXTURE_SWITCHES);
+        }
     }
-    
+
     // Calculate and display FPS
-    currentFPS = 1.0 / deltaTime;
-    fpsHistory.push_back(currentFPS);
-    if (fpsHistory.size() > FPS_HISTORY_SIZE) {
-        fpsHistory.pop_front();
-    }
+    currentFPS = frameTime > 0.0 ? 1.0 / frameTime : 0.0;
+    fpsHistory[fpsSamples++ % FPS_HISTORY_SIZE] = currentFPS;
     
+    size_t samples = std::min(fpsSamples, FPS_HISTORY_SIZE);
     double avgFPS = 0;
-    for (double fps : fpsHistory) avgFPS += fps;
-    avgFPS /= fpsHistory.size();
-    
-    std::stringstream ss;
-    ss << std::fixed << std::setprecision(1) << avgFPS << " FPS";
-    renderText(ss.str(), {255, 255, 255, 255}, 10, 10);
+    for (size_t i = 0; i < samples; i++) avgFPS += fpsHistory[i];
+    avgFPS /= samples;
     
+    {
+        ProfileScope scope(ZONE_TEXT);
+        char* text = renderArena.allocArray<char>(32);
+        snprintf(text, 32, "%.1f FPS", avgFPS);
+        renderText(text, {255, 255, 255, 255}, 10, 10);
+        if (profiler.overlayVisible) renderProfilerOverlay();
+    }
+
     // Present final frame
+    ProfileScope scope(ZONE_PRESENT);
     SDL_RenderPresent(renderer);
 }
 
@@ -846,194 +4932,1186 @@ void render() {
 void cleanup() {
     // Clean cursor
     if (cursor) {
-        SDL_DestroyTexture(cursor->currentTexture);
+        SDL_DestroyTexture(cursor->currentImage.page);
         delete cursor;
     }
 
     // Clean textures
-    for (auto& [name, texture] : textureMap) SDL_DestroyTexture(texture);
-    for (auto& [name, anim] : animationMap) {
-        for (auto& frame : anim.frames) SDL_DestroyTexture(frame);
-    }
+    assetCache.clear();
     for (auto& texture : static_textures) SDL_DestroyTexture(texture);
 
+    for (auto& [textFont, atlas] : glyphAtlases) {
+        for (auto& page : atlas.pages) SDL_DestroyTexture(page);
+    }
+    glyphAtlases.clear();
+    clearStaticLayers();
+
+    // Stop worker threads
+    animationLoader.stop();
+    chunkStreamer.stop();
+    jobSystem.stop();
+
     // Cleanup subsystems
     TTF_CloseFont(font);
     SDL_DestroyRenderer(renderer);
     SDL_DestroyWindow(window);
     IMG_Quit();
+    audio.stop();
+    Mix_CloseAudio();
     Mix_Quit();
     TTF_Quit();
     SDL_Quit();
 
-    std::cout << "Final scale: " << globalScale << std::endl;
+    LOG(LOG_INFO, "Final scale: " << globalScale);
+    logger.stop();
+}
+
+// Structure-of-arrays working set for one NPC tick; lane i is one NPC
+struct NPCBatch {
+    std::vector<EntityId> ids;             // NPC entities
+    std::vector<float> centerX, centerY;   // Foot center at tick start
+    std::vector<float> posX, posY;         // Position in, new position out
+    std::vector<float> maxX, maxY;         // Clamp bounds (map size minus sprite size)
+    std::vector<float> mobile;             // 1 when the NPC may move, 0 when stationary
+    std::vector<float> moveX, moveY;       // Movement this tick
+    std::vector<float> following;          // 1 when chasing the player
+    std::vector<Sint32> footOffX, footOffY;  // footRect offset from rect
+    std::vector<Sint32> rectX, rectY;        // New integer rect position out
+    std::vector<Sint32> footX, footY;        // New footRect position out
+
+    size_t size() const { return ids.size(); }
+
+    void resize(size_t n) {
+        ids.resize(n);
+        for (auto* v : {&centerX, &centerY, &posX, &posY, &maxX, &maxY, &mobile,
+                        &moveX, &moveY, &following}) v->resize(n);
+        for (auto* v : {&footOffX, &footOffY, &rectX, &rectY, &footX, &footY}) v->resize(n);
+    }
+
+    void reserve(size_t n) {
+        ids.reserve(n);
+        for (auto* v : {&centerX, &centerY, &posX, &posY, &maxX, &maxY, &mobile,
+                        &moveX, &moveY, &following}) v->reserve(n);
+        for (auto* v : {&footOffX, &footOffY, &rectX, &rectY, &footX, &footY}) v->reserve(n);
+    }
+};
+
+NPCBatch npcBatch;  // Reused across ticks
+
+// The kernels must produce bit-identical results on every path, so keep the
+// compiler from fusing the scalar multiply-adds into FMAs
+#if defined(__clang__)
+#pragma STDC FP_CONTRACT OFF
+#elif defined(__GNUC__)
+#pragma GCC push_options
+#pragma GCC optimize("fp-contract=off")
+#endif
+
+// Steering for one lane: distance to the player, follow decision and chase
+// movement (zero when not following)
+inline void steerLane(NPCBatch& b, size_t i, float playerX, float playerY, float speedDt) {
+    float dx = playerX - b.centerX[i];
+    float dy = playerY - b.centerY[i];
+    float dist = std::sqrt(dx*dx + dy*dy);
+    bool follow = dist < DETECTION_RADIUS && dist > 5.0f;
+    float slow = dist < 50.0f ? 0.5f : 1.0f;  // Slow down when close to player
+    b.moveX[i] = follow ? dx / dist * speedDt * slow : 0.0f;
+    b.moveY[i] = follow ? dy / dist * speedDt * slow : 0.0f;
+    b.following[i] = follow ? 1.0f : 0.0f;
+}
+
+// Integration for one lane: apply movement, clamp to the world and derive
+// the integer rect and footRect positions
+inline void integrateLane(NPCBatch& b, size_t i) {
+    float nx = b.posX[i] + (b.mobile[i] != 0.0f ? b.moveX[i] : 0.0f);
+    float ny = b.posY[i] + (b.mobile[i] != 0.0f ? b.moveY[i] : 0.0f);
+    nx = nx > 0.0f ? nx : 0.0f;
+    ny = ny > 0.0f ? ny : 0.0f;
+    nx = nx < b.maxX[i] ? nx : b.maxX[i];
+    ny = ny < b.maxY[i] ? ny : b.maxY[i];
+    b.posX[i] = nx;
+    b.posY[i] = ny;
+    b.rectX[i] = static_cast<Sint32>(std::floor(nx));
+    b.rectY[i] = static_cast<Sint32>(std::floor(ny));
+    b.footX[i] = b.rectX[i] + b.footOffX[i];
+    b.footY[i] = b.rectY[i] + b.footOffY[i];
+}
+
+void steerScalar(NPCBatch& b, size_t begin, size_t end, float playerX, float playerY, float speedDt) {
+    for (size_t i = begin; i < end; i++) steerLane(b, i, playerX, playerY, speedDt);
+}
+
+void integrateScalar(NPCBatch& b, size_t begin, size_t end) {
+    for (size_t i = begin; i < end; i++) integrateLane(b, i);
+}
+
+#if NPC_SIMD_X86
+SIMD_TARGET("sse2")
+void steerSSE2(NPCBatch& b, size_t begin, size_t end, float playerX, float playerY, float speedDt) {
+    const __m128 px = _mm_set1_ps(playerX), py = _mm_set1_ps(playerY);
+    const __m128 speed = _mm_set1_ps(speedDt);
+    const __m128 radius = _mm_set1_ps(DETECTION_RADIUS), minDist = _mm_set1_ps(5.0f);
+    const __m128 slowDist = _mm_set1_ps(50.0f), half = _mm_set1_ps(0.5f), one = _mm_set1_ps(1.0f);
+    size_t i = begin;
+    for (; i + 4 <= end; i += 4) {
+        __m128 dx = _mm_sub_ps(px, _mm_loadu_ps(&b.centerX[i]));
+        __m128 dy = _mm_sub_ps(py, _mm_loadu_ps(&b.centerY[i]));
+        __m128 dist = _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)));
+        __m128 follow = _mm_and_ps(_mm_cmplt_ps(dist, radius), _mm_cmpgt_ps(dist, minDist));
+        __m128 isSlow = _mm_cmplt_ps(dist, slowDist);
+        __m128 slow = _mm_or_ps(_mm_and_ps(isSlow, half), _mm_andnot_ps(isSlow, one));
+        __m128 mx = _mm_mul_ps(_mm_mul_ps(_mm_div_ps(dx, dist), speed), slow);
+        __m128 my = _mm_mul_ps(_mm_mul_ps(_mm_div_ps(dy, dist), speed), slow);
+        _mm_storeu_ps(&b.moveX[i], _mm_and_ps(follow, mx));
+        _mm_storeu_ps(&b.moveY[i], _mm_and_ps(follow, my));
+        _mm_storeu_ps(&b.following[i], _mm_and_ps(follow, one));
+    }
+    for (; i < end; i++) steerLane(b, i, playerX, playerY, speedDt);
+}
+
+SIMD_TARGET("sse2")
+void integrateSSE2(NPCBatch& b, size_t begin, size_t end) {
+    const __m128 zero = _mm_setzero_ps();
+    size_t i = begin;
+    for (; i + 4 <= end; i += 4) {
+        __m128 mobile = _mm_cmpneq_ps(_mm_loadu_ps(&b.mobile[i]), zero);
+        __m128 nx = _mm_add_ps(_mm_loadu_ps(&b.posX[i]), _mm_and_ps(mobile, _mm_loadu_ps(&b.moveX[i])));
+        __m128 ny = _mm_add_ps(_mm_loadu_ps(&b.posY[i]), _mm_and_ps(mobile, _mm_loadu_ps(&b.moveY[i])));
+        nx = _mm_min_ps(_mm_max_ps(nx, zero), _mm_loadu_ps(&b.maxX[i]));
+        ny = _mm_min_ps(_mm_max_ps(ny, zero), _mm_loadu_ps(&b.maxY[i]));
+        _mm_storeu_ps(&b.posX[i], nx);
+        _mm_storeu_ps(&b.posY[i], ny);
+
+        // floor(): truncate, then step down where truncation rounded up
+        __m128i rx = _mm_cvttps_epi32(nx);
+        __m128i ry = _mm_cvttps_epi32(ny);
+        rx = _mm_add_epi32(rx, _mm_castps_si128(_mm_cmpgt_ps(_mm_cvtepi32_ps(rx), nx)));
+        ry = _mm_add_epi32(ry, _mm_castps_si128(_mm_cmpgt_ps(_mm_cvtepi32_ps(ry), ny)));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(&b.rectX[i]), rx);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(&b.rectY[i]), ry);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(&b.footX[i]),
+                         _mm_add_epi32(rx, _mm_loadu_si128(reinterpret_cast<const __m128i*>(&b.footOffX[i]))));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(&b.footY[i]),
+                         _mm_add_epi32(ry, _mm_loadu_si128(reinterpret_cast<const __m128i*>(&b.footOffY[i]))));
+    }
+    for (; i < end; i++) integrateLane(b, i);
+}
+
+SIMD_TARGET("avx2")
+void steerAVX2(NPCBatch& b, size_t begin, size_t end, float playerX, float playerY, float speedDt) {
+    const __m256 px = _mm256_set1_ps(playerX), py = _mm256_set1_ps(playerY);
+    const __m256 speed = _mm256_set1_ps(speedDt);
+    const __m256 radius = _mm256_set1_ps(DETECTION_RADIUS), minDist = _mm256_set1_ps(5.0f);
+    const __m256 slowDist = _mm256_set1_ps(50.0f), half = _mm256_set1_ps(0.5f), one = _mm256_set1_ps(1.0f);
+    size_t i = begin;
+    for (; i + 8 <= end; i += 8) {
+        __m256 dx = _mm256_sub_ps(px, _mm256_loadu_ps(&b.centerX[i]));
+        __m256 dy = _mm256_sub_ps(py, _mm256_loadu_ps(&b.centerY[i]));
+        __m256 dist = _mm256_sqrt_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)));
+        __m256 follow = _mm256_and_ps(_mm256_cmp_ps(dist, radius, _CMP_LT_OQ),
+                                      _mm256_cmp_ps(dist, minDist, _CMP_GT_OQ));
+        __m256 slow = _mm256_blendv_ps(one, half, _mm256_cmp_ps(dist, slowDist, _CMP_LT_OQ));
+        __m256 mx = _mm256_mul_ps(_mm256_mul_ps(_mm256_div_ps(dx, dist), speed), slow);
+        __m256 my = _mm256_mul_ps(_mm256_mul_ps(_mm256_div_ps(dy, dist), speed), slow);
+        _mm256_storeu_ps(&b.moveX[i], _mm256_and_ps(follow, mx));
+        _mm256_storeu_ps(&b.moveY[i], _mm256_and_ps(follow, my));
+        _mm256_storeu_ps(&b.following[i], _mm256_and_ps(follow, one));
+    }
+    for (; i < end; i++) steerLane(b, i, playerX, playerY, speedDt);
+}
+
+SIMD_TARGET("avx2")
+void integrateAVX2(NPCBatch& b, size_t begin, size_t end) {
+    const __m256 zero = _mm256_setzero_ps();
+    size_t i = begin;
+    for (; i + 8 <= end; i += 8) {
+        __m256 mobile = _mm256_cmp_ps(_mm256_loadu_ps(&b.mobile[i]), zero, _CMP_NEQ_UQ);
+        __m256 nx = _mm256_add_ps(_mm256_loadu_ps(&b.posX[i]), _mm256_and_ps(mobile, _mm256_loadu_ps(&b.moveX[i])));
+        __m256 ny = _mm256_add_ps(_mm256_loadu_ps(&b.posY[i]), _mm256_and_ps(mobile, _mm256_loadu_ps(&b.moveY[i])));
+        nx = _mm256_min_ps(_mm256_max_ps(nx, zero), _mm256_loadu_ps(&b.maxX[i]));
+        ny = _mm256_min_ps(_mm256_max_ps(ny, zero), _mm256_loadu_ps(&b.maxY[i]));
+        _mm256_storeu_ps(&b.posX[i], nx);
+        _mm256_storeu_ps(&b.posY[i], ny);
+
+        __m256i rx = _mm256_cvttps_epi32(_mm256_floor_ps(nx));
+        __m256i ry = _mm256_cvttps_epi32(_mm256_floor_ps(ny));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(&b.rectX[i]), rx);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(&b.rectY[i]), ry);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(&b.footX[i]),
+                            _mm256_add_epi32(rx, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(&b.footOffX[i]))));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(&b.footY[i]),
+                            _mm256_add_epi32(ry, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(&b.footOffY[i]))));
+    }
+    for (; i < end; i++) integrateLane(b, i);
+}
+#endif
+
+#if NPC_SIMD_NEON
+void steerNEON(NPCBatch& b, size_t begin, size_t end, float playerX, float playerY, float speedDt) {
+    const float32x4_t px = vdupq_n_f32(playerX), py = vdupq_n_f32(playerY);
+    const float32x4_t speed = vdupq_n_f32(speedDt);
+    const float32x4_t radius = vdupq_n_f32(DETECTION_RADIUS), minDist = vdupq_n_f32(5.0f);
+    const float32x4_t slowDist = vdupq_n_f32(50.0f), half = vdupq_n_f32(0.5f), one = vdupq_n_f32(1.0f);
+    size_t i = begin;
+    for (; i + 4 <= end; i += 4) {
+        float32x4_t dx = vsubq_f32(px, vld1q_f32(&b.centerX[i]));
+        float32x4_t dy = vsubq_f32(py, vld1q_f32(&b.centerY[i]));
+        float32x4_t dist = vsqrtq_f32(vaddq_f32(vmulq_f32(dx, dx), vmulq_f32(dy, dy)));
+        uint32x4_t follow = vandq_u32(vcltq_f32(dist, radius), vcgtq_f32(dist, minDist));
+        float32x4_t slow = vbslq_f32(vcltq_f32(dist, slowDist), half, one);
+        float32x4_t mx = vmulq_f32(vmulq_f32(vdivq_f32(dx, dist), speed), slow);
+        float32x4_t my = vmulq_f32(vmulq_f32(vdivq_f32(dy, dist), speed), slow);
+        vst1q_f32(&b.moveX[i], vreinterpretq_f32_u32(vandq_u32(follow, vreinterpretq_u32_f32(mx))));
+        vst1q_f32(&b.moveY[i], vreinterpretq_f32_u32(vandq_u32(follow, vreinterpretq_u32_f32(my))));
+        vst1q_f32(&b.following[i], vreinterpretq_f32_u32(vandq_u32(follow, vreinterpretq_u32_f32(one))));
+    }
+    for (; i < end; i++) steerLane(b, i, playerX, playerY, speedDt);
+}
+
+void integrateNEON(NPCBatch& b, size_t begin, size_t end) {
+    const float32x4_t zero = vdupq_n_f32(0.0f);
+    size_t i = begin;
+    for (; i + 4 <= end; i += 4) {
+        uint32x4_t mobile = vmvnq_u32(vceqq_f32(vld1q_f32(&b.mobile[i]), zero));
+        float32x4_t mx = vreinterpretq_f32_u32(vandq_u32(mobile, vreinterpretq_u32_f32(vld1q_f32(&b.moveX[i]))));
+        float32x4_t my = vreinterpretq_f32_u32(vandq_u32(mobile, vreinterpretq_u32_f32(vld1q_f32(&b.moveY[i]))));
+        float32x4_t nx = vaddq_f32(vld1q_f32(&b.posX[i]), mx);
+        float32x4_t ny = vaddq_f32(vld1q_f32(&b.posY[i]), my);
+        nx = vminq_f32(vmaxq_f32(nx, zero), vld1q_f32(&b.maxX[i]));
+        ny = vminq_f32(vmaxq_f32(ny, zero), vld1q_f32(&b.maxY[i]));
+        vst1q_f32(&b.posX[i], nx);
+        vst1q_f32(&b.posY[i], ny);
+
+        int32x4_t rx = vcvtmq_s32_f32(nx);  // Round toward minus infinity
+        int32x4_t ry = vcvtmq_s32_f32(ny);
+        vst1q_s32(&b.rectX[i], rx);
+        vst1q_s32(&b.rectY[i], ry);
+        vst1q_s32(&b.footX[i], vaddq_s32(rx, vld1q_s32(&b.footOffX[i])));
+        vst1q_s32(&b.footY[i], vaddq_s32(ry, vld1q_s32(&b.footOffY[i])));
+    }
+    for (; i < end; i++) integrateLane(b, i);
+}
+#endif
+
+#if defined(__clang__)
+#pragma STDC FP_CONTRACT DEFAULT
+#elif defined(__GNUC__)
+#pragma GCC pop_options
+#endif
+
+// One implementation of the NPC steering/integration kernels
+struct NPCKernels {
+    const char* name;
+    void (*steer)(NPCBatch&, size_t, size_t, float, float, float);
+    void (*integrate)(NPCBatch&, size_t, size_t);
+};
+
+// Kernel sets usable on this CPU, best first; the scalar set is always last
+std::vector<NPCKernels> availableNPCKernels() {
+    std::vector<NPCKernels> kernels;
+#if NPC_SIMD_X86
+    if (SDL_HasAVX2()) kernels.push_back({"avx2", steerAVX2, integrateAVX2});
+    if (SDL_HasSSE2()) kernels.push_back({"sse2", steerSSE2, integrateSSE2});
+#elif NPC_SIMD_NEON
+    if (SDL_HasNEON()) kernels.push_back({"neon", steerNEON, integrateNEON});
+#endif
+    kernels.push_back({"scalar", steerScalar, integrateScalar});
+    return kernels;
+}
+
+NPCKernels npcKernels = {"scalar", steerScalar, integrateScalar};  // Selected at startup
+std::string npcKernelOverride;  // --simd=<name> forces a kernel set
+
+// Pick the best kernel set, or the one named by --simd if available
+void selectNPCKernels() {
+    std::vector<NPCKernels> kernels = availableNPCKernels();
+    npcKernels = kernels.front();
+    for (const auto& k : kernels) {
+        if (npcKernelOverride == k.name) npcKernels = k;
+    }
+    LOG(LOG_INFO, "NPC kernels: " << npcKernels.name);
+}
+
+NPCBatch npcMidBatch;                          // Mid-tier NPCs due this tick
+Uint32 npcTick = 0;                            // Ticks simulated, for LOD staggering
+size_t npcTierCounts[NPC_TIER_COUNT] = {};     // NPCs per tier in the last tick
+
+// Advance the wander timer, picking a new direction when it runs out
+void advanceWanderTimer(NPCState& st, double dt) {
+    st.wanderTimer += dt;
+    if (st.wanderTimer >= WANDER_CHANGE_TIME) {
+        st.wanderAngle = float(nextRandom(st.rngState) * 2.0 * M_PI);
+        st.wanderTimer = 0.0f;
+    }
+}
+
+// Debug check, once a level has loaded: two NPCs streamed in at different
+// positions must not pick the same wander direction
+void checkStreamedWander() {
+    if (mapTemplates.empty()) return;
+    WorldChunk chunk;
+    chunk.records = {{0, {0, 0}}, {0, {CHUNK_SIZE / 2, CHUNK_SIZE / 3}}};
+    buildChunk(chunk);
+    NPCState a = chunk.entities[0].state, b = chunk.entities[1].state;
+    advanceWanderTimer(a, WANDER_CHANGE_TIME);
+    advanceWanderTimer(b, WANDER_CHANGE_TIME);
+    assert(a.wanderAngle != b.wanderAngle && "streamed NPCs share a wander direction");
+}
+
+// Wander, aggro and separation for one lane over a step of dt seconds. These
+// steps branch per NPC and call trig functions, so they stay scalar. Each
+// NPC's state slot is owned by its lane, so it is updated in place even when
+// running in parallel.
+void updateNPCBehavior(NPCBatch& b, size_t i, float playerX, float playerY, double dt) {
+    EntityId id = b.ids[i];
+    const GameSprite& spr = gameSprites[id];
+    NPCState& st = npcStates[id];
+
+    if (spr.kind == kindReyna) {
+        // Reyna is stationary, no movement
+        st.isStationary = true;
+        st.isWandering = false;
+    }
+    st.isFollowing = b.following[i] != 0.0f;
+
+    // Aggro groups: near the player, join same-kind neighbors that were
+    // chasing last tick
+    float toPlayerX = playerX - b.centerX[i], toPlayerY = playerY - b.centerY[i];
+    float playerDist = std::sqrt(toPlayerX * toPlayerX + toPlayerY * toPlayerY);
+    if (!st.isFollowing && !st.isStationary && playerDist < NPC_AGGRO_RANGE && playerDist > 5.0f) {
+        SDL_Rect area = {static_cast<int>(b.centerX[i] - NPC_AGGRO_RADIUS), static_cast<int>(b.centerY[i] - NPC_AGGRO_RADIUS),
+                         static_cast<int>(NPC_AGGRO_RADIUS * 2), static_cast<int>(NPC_AGGRO_RADIUS * 2)};
+        bool aggro = false;
+        footHash.forEachCandidate(area, [&](const SpatialHash::Entry& e) {
+            if (aggro || !e.following || e.kind != spr.kind || e.id == id) return;
+            float dx = e.foot.x + e.foot.w / 2.0f - b.centerX[i];
+            float dy = e.foot.y + e.foot.h / 2.0f - b.centerY[i];
+            aggro = dx * dx + dy * dy <= NPC_AGGRO_RADIUS * NPC_AGGRO_RADIUS;
+        });
+        if (aggro) {
+            st.isFollowing = true;
+            b.following[i] = 1.0f;
+            b.moveX[i] = toPlayerX / playerDist * NPC_SPEED * dt;
+            b.moveY[i] = toPlayerY / playerDist * NPC_SPEED * dt;
+        }
+    }
+
+    if (!st.isFollowing && st.isWandering) {
+        float scale = 0.5f;
+        // Random wandering
+        advanceWanderTimer(st, dt);
+        b.moveX[i] = std::cos(st.wanderAngle) * NPC_SPEED * scale * dt;
+        b.moveY[i] = std::sin(st.wanderAngle) * NPC_SPEED * scale * dt;
+    }
+
+    // Separation: push away from NPCs standing too close
+    if (b.mobile[i] != 0.0f) {
+        SDL_Rect area = {static_cast<int>(b.centerX[i] - NPC_SEPARATION_RADIUS), static_cast<int>(b.centerY[i] - NPC_SEPARATION_RADIUS),
+                         static_cast<int>(NPC_SEPARATION_RADIUS * 2), static_cast<int>(NPC_SEPARATION_RADIUS * 2)};
+        float pushX = 0.0f, pushY = 0.0f;
+        footHash.forEachCandidate(area, [&](const SpatialHash::Entry& e) {
+            if (e.isStatic || e.id == id || e.kind == kindPlayer) return;
+            float dx = b.centerX[i] - (e.foot.x + e.foot.w / 2.0f);
+            float dy = b.centerY[i] - (e.foot.y + e.foot.h / 2.0f);
+            float dist = std::sqrt(dx * dx + dy * dy);
+            if (dist >= NPC_SEPARATION_RADIUS) return;
+            if (dist < 0.001f) {
+                // Exactly stacked: split by ID
+                dx = id < e.id ? -1.0f : 1.0f;
+                dy = 0.0f;
+                dist = 1.0f;
+            }
+            float weight = (NPC_SEPARATION_RADIUS - dist) / NPC_SEPARATION_RADIUS;
+            pushX += dx / dist * weight;
+            pushY += dy / dist * weight;
+        });
+        b.moveX[i] += pushX * NPC_SEPARATION_SPEED * NPC_SPEED * dt;
+        b.moveY[i] += pushY * NPC_SEPARATION_SPEED * NPC_SPEED * dt;
+    }
+}
+
+// Keep an NPC's new foot rectangle out of static props, sliding along one
+// axis when possible
+void resolveNPCCollision(NPCBatch& b, size_t i) {
+    const GameSprite& spr = gameSprites[b.ids[i]];
+    SDL_Rect to = {b.footX[i], b.footY[i], spr.footRect.w, spr.footRect.h};
+    if (!footHash.blocked(spr.footRect, to)) return;
+
+    const float candidates[2][2] = {{b.posX[i], spr.posY}, {spr.posX, b.posY[i]}};
+    float nx = spr.posX, ny = spr.posY;
+    for (const auto& c : candidates) {
+        int rx = static_cast<int>(std::floor(c[0]));
+        int ry = static_cast<int>(std::floor(c[1]));
+        SDL_Rect slide = {rx + b.footOffX[i], ry + b.footOffY[i], spr.footRect.w, spr.footRect.h};
+        if (!footHash.blocked(spr.footRect, slide)) {
+            nx = c[0];
+            ny = c[1];
+            break;
+        }
+    }
+    b.posX[i] = nx;
+    b.posY[i] = ny;
+    b.rectX[i] = static_cast<Sint32>(std::floor(nx));
+    b.rectY[i] = static_cast<Sint32>(std::floor(ny));
+    b.footX[i] = b.rectX[i] + b.footOffX[i];
+    b.footY[i] = b.rectY[i] + b.footOffY[i];
+}
+
+// Simulate the NPCs listed in a batch over a step of dt seconds: fill the
+// SoA lanes, run the SIMD kernels and scalar behavior in parallel chunks on
+// the job system, then commit the results on this thread
+void simulateNPCBatch(NPCBatch& b, float playerX, float playerY, double dt) {
+    b.resize(b.ids.size());
+    profiler.count(COUNTER_ENTITIES_UPDATED, b.ids.size());
+    for (size_t i = 0; i < b.size(); i++) {
+        const GameSprite& spr = gameSprites[b.ids[i]];
+        b.centerX[i] = spr.footRect.x + spr.footRect.w/2.0f;
+        b.centerY[i] = spr.footRect.y + spr.footRect.h/2.0f;
+        b.posX[i] = spr.posX;
+        b.posY[i] = spr.posY;
+        b.maxX[i] = static_cast<float>(worldWidth - spr.rect.w);
+        b.maxY[i] = static_cast<float>(worldHeight - spr.rect.h);
+        b.mobile[i] = spr.kind != kindReyna ? 1.0f : 0.0f;
+        b.footOffX[i] = (spr.rect.w - spr.footW) / 2;
+        b.footOffY[i] = spr.rect.h - spr.footH;
+    }
+
+    // Simulate phase: chunks are independent, so they run concurrently
+    float speedDt = static_cast<float>(NPC_SPEED * dt);
+    jobSystem.parallelFor(b.size(), NPC_JOB_GRAIN, [&](size_t begin, size_t end) {
+        npcKernels.steer(b, begin, end, playerX, playerY, speedDt);
+        for (size_t i = begin; i < end; i++) updateNPCBehavior(b, i, playerX, playerY, dt);
+        npcKernels.integrate(b, begin, end);
+        for (size_t i = begin; i < end; i++) resolveNPCCollision(b, i);
+    });
+
+    // Commit phase: write results back and re-index moved NPCs; depth
+    // order is restored later by sortDrawOrder()
+    for (size_t i = 0; i < b.size(); i++) {
+        EntityId id = b.ids[i];
+        GameSprite& spr = gameSprites[id];
+        spr.prevPos = {spr.posX, spr.posY};
+        spr.posX = b.posX[i];
+        spr.posY = b.posY[i];
+        spr.rect.x = b.rectX[i];
+        spr.rect.y = b.rectY[i];
+        spr.footRect.x = b.footX[i];
+        spr.footRect.y = b.footY[i];
+        spatialGrid.update(id, spr.rect);
+
+        /* facingLeft now driven by 8-way logic */
+        // Update facing direction
+        if (std::abs(b.moveX[i]) > 0.1f) {
+            spr.facingLeft = (b.moveX[i] < 0);
+        }
+    }
 }
 
-// Update NPC behavior and position
+// Update NPC behavior and position, with the level of detail chosen per NPC
+// by distance to the player and the camera
 void updateNPCs() {
     // Find player position
-    SDL_Point playerPos{0, 0};
-    bool playerFound = false;
-    auto pit = std::find_if(gameSprites.begin(), gameSprites.end(),
-        [](const GameSprite& s) { return s.spriteName == "aaron"; });
-    
-    if (pit != gameSprites.end()) {
-        // Use center of player's foot rectangle
-        playerPos.x = pit->footRect.x + pit->footRect.w/2;
-        playerPos.y = pit->footRect.y + pit->footRect.h/2;
-        playerFound = true;
-    }
+    if (playerId == INVALID_ENTITY) return; // Skip if no player
 
-    if (!playerFound) return; // Skip if no player
+    // Use center of player's foot rectangle
+    const GameSprite& player = gameSprites[playerId];
+    float playerX = static_cast<float>(player.footRect.x + player.footRect.w/2);
+    float playerY = static_cast<float>(player.footRect.y + player.footRect.h/2);
 
-    // Container for updated NPCs
-    std::vector<GameSprite> updated;
-    auto it = gameSprites.begin();
+    SDL_Rect view = cameraWorldRect();
+    view = {view.x - NPC_LOD_VIEW_MARGIN, view.y - NPC_LOD_VIEW_MARGIN,
+            view.w + 2 * NPC_LOD_VIEW_MARGIN, view.h + 2 * NPC_LOD_VIEW_MARGIN};
+    const float nearSq = NPC_LOD_NEAR_DISTANCE * NPC_LOD_NEAR_DISTANCE;
+    const float midSq = NPC_LOD_MID_DISTANCE * NPC_LOD_MID_DISTANCE;
+    npcTick++;
 
-    while (it != gameSprites.end()) {
-        const auto& spr = *it;
-        // Skip non-NPCs
-        if (spr.spriteName == "aaron" || !spr.isAnimated || spr.spriteName == "background") {
-            ++it;
+    // Gather phase: sort NPCs into tiers; mid and far NPCs only run when
+    // their staggered interval comes up. Both batches hold room for every
+    // entity, so NPCs changing tiers never grow them
+    NPCBatch& nearBatch = npcBatch;
+    nearBatch.ids.clear();
+    npcMidBatch.ids.clear();
+    nearBatch.reserve(gameSprites.size());
+    npcMidBatch.reserve(gameSprites.size());
+    std::fill(std::begin(npcTierCounts), std::end(npcTierCounts), 0);
+    for (EntityId id = 0; id < gameSprites.size(); id++) {
+        GameSprite& spr = gameSprites[id];
+        // Skip non-NPCs and free slots
+        if (!spr.alive || spr.kind == kindPlayer || !spr.isAnimated || spr.kind == kindBackground) {
             continue;
         }
 
-        // Create modifiable copy
-        GameSprite copy = spr;
-        
-        // Calculate distance to player
-        float npcCenterX = copy.footRect.x + copy.footRect.w/2.0f;
-        float npcCenterY = copy.footRect.y + copy.footRect.h/2.0f;
-        
-        float dx = playerPos.x - npcCenterX;
-        float dy = playerPos.y - npcCenterY;
-        float dist = std::sqrt(dx*dx + dy*dy);
-
-        // Get NPC state using unique identifier
-        std::string npcKey = spr.spriteName + "_" + 
-                            std::to_string(spr.rect.x) + "_" + 
-                            std::to_string(spr.rect.y);
-        auto& st = npcStates[npcKey];
+        float dx = spr.footRect.x + spr.footRect.w/2.0f - playerX;
+        float dy = spr.footRect.y + spr.footRect.h/2.0f - playerY;
+        float distSq = dx * dx + dy * dy;
+        NPCTier tier = NPC_TIER_FAR;
+        if (distSq < nearSq || SDL_HasIntersection(&spr.rect, &view)) tier = NPC_TIER_NEAR;
+        else if (distSq < midSq) tier = NPC_TIER_MID;
+        npcTierCounts[tier]++;
 
-        // Movement calculation
-        float mx = 0, my = 0;
-        if (spr.spriteName == "reyna") {
-            // Reyna is stationary, no movement
-            st.isStationary = true;
-            st.isWandering = false;
-            st.isFollowing = false;
+        if (tier == NPC_TIER_NEAR) {
+            nearBatch.ids.push_back(id);
+            continue;
+        }
+        spr.prevPos = {spr.posX, spr.posY};  // Not moving this tick
+        if (tier == NPC_TIER_MID) {
+            if ((npcTick + id) % NPC_LOD_MID_INTERVAL == 0) npcMidBatch.ids.push_back(id);
+        } else if ((npcTick + id) % NPC_LOD_FAR_INTERVAL == 0) {
+            // Far: timers only, so the NPC resumes naturally when it comes
+            // closer; animation follows the clock and needs no update
+            NPCState& st = npcStates[id];
+            if (st.isWandering) advanceWanderTimer(st, deltaTime * NPC_LOD_FAR_INTERVAL);
         }
+    }
 
-        
-        st.isFollowing = (dist < DETECTION_RADIUS && dist > 5.0f);
+    simulateNPCBatch(nearBatch, playerX, playerY, deltaTime);
+    simulateNPCBatch(npcMidBatch, playerX, playerY, deltaTime * NPC_LOD_MID_INTERVAL);
+}
 
-        if (st.isFollowing && dist > 0) {
-            // Chase player with normalized direction
-            float dirX = dx / dist;
-            float dirY = dy / dist;
-            
-            mx = dirX * NPC_SPEED * deltaTime;
-            my = dirY * NPC_SPEED * deltaTime;
-            
-            // Slow down when close to player
-            if (dist < 50.0f) {
-                mx *= 0.5f;
-                my *= 0.5f;
+// Micro-benchmark of the steering/integration kernels (--bench-steering).
+// Every kernel set must reproduce the scalar results bit for bit.
+void runSteeringBenchmark() {
+    std::vector<NPCKernels> kernels = availableNPCKernels();
+    const size_t sizes[] = {1000, 10000, 100000};
+    const float playerX = MAP_WIDTH / 2.0f, playerY = MAP_HEIGHT / 2.0f;
+    const float speedDt = NPC_SPEED / 60.0f;
+
+    for (size_t n : sizes) {
+        // Synthetic crowd; some NPCs start within the detection radius
+        NPCBatch input;
+        input.resize(n);
+        Uint32 seed = 12345;
+        for (size_t i = 0; i < n; i++) {
+            input.ids[i] = i;
+            bool near = (i % 4) == 0;
+            input.centerX[i] = near ? playerX + (nextRandom(seed) - 0.5f) * 100.0f : nextRandom(seed) * MAP_WIDTH;
+            input.centerY[i] = near ? playerY + (nextRandom(seed) - 0.5f) * 100.0f : nextRandom(seed) * MAP_HEIGHT;
+            input.posX[i] = input.centerX[i] - 12.0f;
+            input.posY[i] = input.centerY[i] - 20.0f;
+            input.maxX[i] = MAP_WIDTH - 24.0f;
+            input.maxY[i] = MAP_HEIGHT - 24.0f;
+            input.mobile[i] = (i % 16) ? 1.0f : 0.0f;
+            input.footOffX[i] = 5;
+            input.footOffY[i] = 19;
+        }
+
+        const int iterations = static_cast<int>(std::max<size_t>(10, 20000000 / n));
+        NPCBatch reference;
+        double scalarTime = 0.0;
+        for (auto it = kernels.rbegin(); it != kernels.rend(); ++it) {
+            NPCBatch b = input;
+            auto start = std::chrono::steady_clock::now();
+            for (int iter = 0; iter < iterations; iter++) {
+                // Reset positions so every iteration does identical work
+                std::copy(input.posX.begin(), input.posX.end(), b.posX.begin());
+                std::copy(input.posY.begin(), input.posY.end(), b.posY.begin());
+                it->steer(b, 0, n, playerX, playerY, speedDt);
+                it->integrate(b, 0, n);
             }
-        } else if (st.isWandering) {
-            float scale = 0.5f;
-            // Random wandering
-            st.wanderTimer += deltaTime;
-            if (st.wanderTimer >= WANDER_CHANGE_TIME) {
-                st.wanderAngle = (float(rand() * deltaTime)/RAND_MAX * 2.0f * M_PI);
-                st.wanderTimer = 0.0f;
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            double nsPerNPC = seconds * 1e9 / (static_cast<double>(iterations) * n);
+
+            bool identical = true;
+            if (it == kernels.rbegin()) {
+                reference = b;
+                scalarTime = seconds;
+            } else {
+                identical = b.posX == reference.posX && b.posY == reference.posY &&
+                            b.moveX == reference.moveX && b.moveY == reference.moveY &&
+                            b.following == reference.following && b.rectX == reference.rectX &&
+                            b.rectY == reference.rectY && b.footX == reference.footX &&
+                            b.footY == reference.footY;
             }
-            mx = std::cos(st.wanderAngle) * NPC_SPEED * scale * deltaTime;
-            my = std::sin(st.wanderAngle) * NPC_SPEED * scale * deltaTime;
+            std::cout << std::setw(7) << n << " NPCs  " << std::setw(6) << it->name << "  "
+                      << std::fixed << std::setprecision(2) << std::setw(7) << nsPerNPC << " ns/NPC  "
+                      << std::setprecision(2) << scalarTime / seconds << "x"
+                      << (identical ? "" : "  MISMATCH vs scalar") << std::endl;
+        }
+    }
+}
+
+// Turn the sounds triggered this frame into commands with a gain and pan
+// relative to the camera center. Sounds fade out over one view diagonal, so
+// zooming out also widens what can be heard.
+void recordSounds(RenderFrame& frame) {
+    frame.sounds.clear();
+    frame.sounds.reserve(MAX_FRAME_SOUNDS);
+    if (pendingSounds.empty()) return;
+    float viewW = SCREEN_WIDTH / globalScale, viewH = SCREEN_HEIGHT / globalScale;
+    float listenerX = -backgroundOffset.x + viewW / 2.0f, listenerY = -backgroundOffset.y + viewH / 2.0f;
+    float range = std::hypot(viewW, viewH);
+    for (const SoundEvent& event : pendingSounds) {
+        float dx = event.pos.x - listenerX, dy = event.pos.y - listenerY;
+        float falloff = std::max(0.0f, 1.0f - std::hypot(dx, dy) / range);
+        frame.sounds.push_back({event.sound, falloff * falloff, std::clamp(dx / (viewW / 2.0f), -1.0f, 1.0f)});
+    }
+    pendingSounds.clear();
+}
+
+std::string bakeLevelName;  // --bake=<level> bakes a bundle instead of running
+std::string recordPath;     // --record=<file> writes an input log
+std::string replayPath;     // --replay=<file> plays one back instead of reading input
+
+// Run the simulation ticks due after elapsed seconds of wall time, then
+// prepare and record the next frame into frame
+double tickAccumulator = 0.0;  // Simulation time not yet consumed by ticks
+void simulateFrame(double elapsed, RenderFrame& frame) {
+    ProfileScope frameScope(ZONE_SIMULATE);
+    simulationArena.reset();
+    tickAccumulator += elapsed;
+    while (tickAccumulator >= deltaTime) {
+        {
+            ProfileScope scope(ZONE_PLAYER);
+            footHash.build(gameSprites, FOOT_HASH_CELL_SIZE);
+            updatePlayer();
         }
-        else if (st.isStationary) {
-            // Stationary NPCs do not move
-            mx = 0;
-            my = 0;
+        {
+            ProfileScope scope(ZONE_NPCS);
+            updateNPCs();
         }
+        animationClock += deltaTime;
+        tickAccumulator -= deltaTime;
+    }
+    renderAlpha = static_cast<float>(tickAccumulator / deltaTime);
+
+    {
+        ProfileScope scope(ZONE_STREAMING);
+        updateCamera();
+        updateWorldStreaming();
+    }
+    {
+        ProfileScope scope(ZONE_SORT);
+        sortDrawOrder();
+        updateVisibleAnimations();
+    }
+    ProfileScope scope(ZONE_RECORD);
+    recordRenderCommands(frame);
+    recordSounds(frame);
+}
 
-        int newX, newY;
+// Thread that simulates frame N+1 while the main thread renders and
+// presents frame N. SDL event handling and rendering stay on the main
+// thread; the two only meet between frames, in begin() and wait(), so the
+// main thread may touch game state whenever no frame is in flight.
+struct SimulationThread {
+    std::thread worker;
+    std::mutex mutex;
+    std::condition_variable wake, done;
+    double elapsed = 0.0;      // Wall time for the pending frame
+    RenderFrame* target = nullptr;
+    bool pending = false;      // A frame has been requested and not finished
+    bool stopping = false;
 
-        // Update position with bounds checking
-        if(spr.spriteName != "reyna")
+    ~SimulationThread() { stop(); }
+
+    void start() {
+        stopping = false;
+        worker = std::thread([this]() {
+            countHeapAllocations = true;
+            std::unique_lock<std::mutex> lock(mutex);
+            while (true) {
+                wake.wait(lock, [this]() { return stopping || (pending && target); });
+                if (stopping) return;
+                RenderFrame* frame = target;
+                target = nullptr;
+                lock.unlock();
+                simulateFrame(elapsed, *frame);
+                lock.lock();
+                pending = false;
+                done.notify_all();
+            }
+        });
+    }
+
+    void stop() {
+        if (!worker.joinable()) return;
+        wait();
         {
-            // For non-reyna NPCs, apply movement
-            newX = copy.rect.x + static_cast<int>(std::round(mx));
-            newY = copy.rect.y + static_cast<int>(std::round(my));
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        worker.join();
+    }
+
+    // Start simulating a frame into frame; runs inline without a thread
+    void begin(double frameElapsed, RenderFrame& frame) {
+        if (!worker.joinable()) {
+            simulateFrame(frameElapsed, frame);
+            return;
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        elapsed = frameElapsed;
+        target = &frame;
+        pending = true;
+        wake.notify_one();
+    }
+
+    // Wait for the frame started by begin()
+    void wait() {
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [this]() { return !pending; });
+    }
+};
+
+SimulationThread simulationThread;
+bool simulationThreadEnabled = true;  // Simulate on a separate thread (--no-sim-thread to disable)
+
+// Scene benchmark (--bench[=N,N,...]): synthetic levels of N sprites are
+// simulated and rendered headless for a fixed number of frames with scripted
+// input and a fixed seed, one tick per frame, and the update and render
+// phases are timed separately. The final state hash makes runs comparable.
+std::vector<size_t> benchSpriteCounts = {100, 1000, 10000, 100000};
+int benchFrames = 600;  // --bench-frames=N
+bool sceneBenchmark = false;
+
+// Replace the world with a synthetic level of about spriteCount sprites,
+// using the loaded level's art at level1's mix and density of objects
+void generateSyntheticLevel(size_t spriteCount) {
+    clearWorld();
+    const double areaPerSprite = 1600.0 * 1200.0 / 350.0;
+    int width = std::max(SCREEN_WIDTH, static_cast<int>(std::sqrt(spriteCount * areaPerSprite * 4.0 / 3.0)));
+    int height = std::max(SCREEN_HEIGHT, width * 3 / 4);
+    beginWorld(width, height);
+
+    // Tile the background over the world
+    std::vector<SDL_Point> positions;
+    auto background = textureMap.find("background");
+    if (background != textureMap.end() && background->second.src.w > 0 && background->second.src.h > 0) {
+        for (int y = 0; y < height; y += background->second.src.h) {
+            for (int x = 0; x < width; x += background->second.src.w) positions.push_back({x, y});
+        }
+        spawnMapObjects("background", positions.data(), positions.size());
+    }
+
+    Uint32 seed = simulationSeed | 1u;
+    const std::pair<const char*, double> mix[] = {{"mushroom", 200.0 / 350}, {"tree", 100.0 / 350}, {"rock", 50.0 / 350}};
+    for (const auto& [name, share] : mix) {
+        positions.resize(static_cast<size_t>(spriteCount * share));
+        for (SDL_Point& p : positions) {
+            p = {static_cast<int>(nextRandom(seed) * (width - 32)), static_cast<int>(nextRandom(seed) * (height - 32))};
+        }
+        spawnMapObjects(name, positions.data(), positions.size());
+    }
+    SDL_Point start = {width / 2, height / 2};
+    spawnMapObjects("aaron", &start, 1);
+    resolvePlayerAnimations();
+}
+
+// Scripted input for a benchmark frame: walk a square, two seconds a side
+void scriptedInput(int frame) {
+    g_input = InputState();
+    switch ((frame / 120) % 4) {
+        case 0: g_input.right = true; break;
+        case 1: g_input.down = true; break;
+        case 2: g_input.left = true; break;
+        case 3: g_input.up = true; break;
+    }
+}
+
+// Hash of every live sprite's position, to check that runs are reproducible
+Uint32 worldStateHash() {
+    Uint32 hash = 2166136261u;
+    for (const GameSprite& sprite : gameSprites) {
+        if (!sprite.alive) continue;
+        for (float v : {sprite.posX, sprite.posY}) {
+            Uint32 bits;
+            std::memcpy(&bits, &v, sizeof(bits));
+            hash = (hash ^ bits) * 16777619u;
+        }
+    }
+    return hash;
+}
+
+// Input log (--record=<file>, --replay=<file>): the settings the simulation
+// starts from, then per frame the wall time it simulated, the key state and
+// the input events, and at exit the frame count and world state hash.
+// Values are packed in native byte order. A replay feeds the same frames
+// through the same fixed ticks and per-entity random streams, so it ends
+// in the recorded state however fast it runs.
+const char INPUT_LOG_MAGIC[4] = {'I', 'N', 'P', 'L'};
+const Uint32 INPUT_LOG_VERSION = 1;
+enum InputLogRecord : Uint8 { INPUT_LOG_FRAME = 1, INPUT_LOG_END = 2 };
+
+struct InputLog {
+    enum Mode { OFF, RECORD, REPLAY };
+    Mode mode = OFF;
+    std::string path;
+    bool realTime = true;         // Replay at the recorded pace (--replay-fast runs flat out)
+    Uint32 frames = 0;            // Frames recorded or replayed
+
+    // Recording
+    std::ofstream out;
+
+    // Replay
+    std::vector<char> data;       // Whole log
+    size_t readOffset = 0;
+    double replayedSeconds = 0.0; // Recorded wall time replayed so far
+    std::chrono::steady_clock::time_point started;
+    std::vector<double> frameMs;  // Profiled time of every replayed frame
+    double zoneMs[ZONE_COUNT] = {};
+
+    template <typename T>
+    void write(const T& value) { out.write(reinterpret_cast<const char*>(&value), sizeof(T)); }
+
+    template <typename T>
+    bool read(T& value) {
+        if (data.size() - readOffset < sizeof(T)) return false;
+        std::memcpy(&value, data.data() + readOffset, sizeof(T));
+        readOffset += sizeof(T);
+        return true;
+    }
+
+    // Start recording; the header captures what the simulation starts from
+    bool startRecording(const std::string& logPath, const std::string& level) {
+        out.open(logPath, std::ios::binary);
+        if (!out) {
+            LOG(LOG_ERROR, "Could not write input log: " << logPath);
+            return false;
+        }
+        path = logPath;
+        mode = RECORD;
+        out.write(INPUT_LOG_MAGIC, sizeof(INPUT_LOG_MAGIC));
+        write(INPUT_LOG_VERSION);
+        write(simulationSeed);
+        write(tickRate);
+        write(globalScale);
+        write(PLAYER_SPEED);
+        write(static_cast<Uint8>(level.size()));
+        out.write(level.data(), static_cast<std::streamsize>(std::min<size_t>(level.size(), 255)));
+        return true;
+    }
+
+    // Load a log and restore the settings it was recorded with; level is the
+    // level it starts in
+    bool startReplay(const std::string& logPath, std::string& level) {
+        std::ifstream in(logPath, std::ios::binary);
+        if (!in) {
+            LOG(LOG_ERROR, "Could not open input log: " << logPath);
+            return false;
+        }
+        data.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+        readOffset = 0;
+        char magic[4];
+        Uint32 version = 0;
+        Uint8 levelLength = 0;
+        bool valid = read(magic) && std::memcmp(magic, INPUT_LOG_MAGIC, sizeof(magic)) == 0 &&
+                     read(version) && version == INPUT_LOG_VERSION &&
+                     read(simulationSeed) && read(tickRate) && read(globalScale) && read(PLAYER_SPEED) &&
+                     read(levelLength) && data.size() - readOffset >= levelLength;
+        if (!valid) {
+            LOG(LOG_ERROR, "Not an input log of version " << INPUT_LOG_VERSION << ": " << logPath);
+            return false;
+        }
+        level.assign(data.data() + readOffset, levelLength);
+        readOffset += levelLength;
+        path = logPath;
+        mode = REPLAY;
+        replayingInput = true;
+        frameMs.reserve(data.size() / 11);  // Smallest frame record
+        return true;
+    }
+
+    // Record this frame's input, or replace it with the next logged frame.
+    // False when the replay is over.
+    bool frame(double& elapsed) {
+        if (mode == RECORD) {
+            Uint8 keys = static_cast<Uint8>((g_input.up ? 1 : 0) | (g_input.down ? 2 : 0) |
+                                            (g_input.left ? 4 : 0) | (g_input.right ? 8 : 0));
+            write(INPUT_LOG_FRAME);
+            write(elapsed);
+            write(keys);
+            write(static_cast<Uint16>(frameEvents.size()));
+            for (const InputEvent& event : frameEvents) {
+                write(event.type);
+                write(event.x);
+                write(event.y);
+            }
+            frames++;
+            return true;
+        }
+        if (mode != REPLAY) return true;
+
+        // Statistics of the frame just finished
+        if (frames == 0) {
+            started = std::chrono::steady_clock::now();
         } else {
-            // For Reyna, use a fixed position
-            newX = copy.rect.x;
-            newY = copy.rect.y;
+            const FrameProfiler::FrameStats& stats = profiler.recent(0);
+            frameMs.push_back(stats.frameMs);
+            for (int z = 0; z < ZONE_COUNT; z++) zoneMs[z] += stats.zoneMs[z];
         }
-        
-        copy.rect.x = std::clamp(newX, 0, MAP_WIDTH - copy.rect.w);
-        copy.rect.y = std::clamp(newY, 0, MAP_HEIGHT - copy.rect.h);
-        
-        // Update foot rectangle
-        copy.footRect.x = copy.rect.x + (copy.rect.w - copy.footW)/2;
-        copy.footRect.y = copy.rect.y + copy.rect.h - copy.footH;
-        
-        /* facingLeft now driven by 8-way logic */
-        // Update facing direction
-        if (std::abs(mx) > 0.1f) {
-            copy.facingLeft = (mx < 0);
+
+        Uint8 record = 0, keys = 0;
+        Uint16 eventCount = 0;
+        if (!read(record) || record != INPUT_LOG_FRAME || !read(elapsed) || !read(keys) || !read(eventCount)) {
+            finishReplay(record);
+            return false;
+        }
+        g_input.up = keys & 1;
+        g_input.down = keys & 2;
+        g_input.left = keys & 4;
+        g_input.right = keys & 8;
+        for (Uint16 i = 0; i < eventCount; i++) {
+            InputEvent event;
+            if (!read(event.type) || !read(event.x) || !read(event.y)) {
+                finishReplay(0);
+                return false;
+            }
+            applyInputEvent(event);
         }
+        frames++;
 
-        // Update animation
-        if (copy.isAnimated) {
-            // Use the animation that was set up during map load
-            auto animIt = animationMap.find(copy.currentAnimName);  // Use currentAnimName instead of animName
-            if (animIt != animationMap.end()) {
-                animation& anim = animIt->second;
-                
-                copy.animAccumulator += deltaTime;
-                if (copy.animAccumulator >= (anim.frameDelay / 1000.0)) {
-                    copy.currentFrame = (copy.currentFrame + 1) % anim.frames.size();
-                    copy.currentTexture = anim.frames[copy.currentFrame];
-                    copy.animAccumulator = 0;
-                }
+        // Keep to the recorded pace
+        replayedSeconds += elapsed;
+        if (realTime) {
+            double ahead = replayedSeconds - std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+            if (ahead > 0.001) SDL_Delay(static_cast<Uint32>(ahead * 1000.0));
+        }
+        return true;
+    }
+
+    // Report a finished replay; record is the record that ended it
+    void finishReplay(Uint8 record) {
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+        std::stringstream ss;
+        ss << std::fixed << std::setprecision(2) << "Replayed " << path << ": " << frames << " frames in "
+           << seconds << " s (" << std::setprecision(0) << frames / std::max(seconds, 1e-9) << " fps, recorded "
+           << std::setprecision(2) << replayedSeconds << " s)";
+        LOG(LOG_INFO, ss.str());
+        if (!frameMs.empty()) {
+            std::sort(frameMs.begin(), frameMs.end());
+            double avg = 0.0;
+            for (double ms : frameMs) avg += ms;
+            avg /= frameMs.size();
+            size_t rank = std::min(frameMs.size() - 1, static_cast<size_t>(std::ceil(frameMs.size() * 0.99)) - 1);
+            LOG(LOG_INFO, std::fixed << std::setprecision(2) << "  frame  min " << frameMs.front() << "  avg " << avg
+                          << "  p99 " << frameMs[rank] << "  max " << frameMs.back() << " ms");
+            for (int z = 0; z < ZONE_COUNT; z++) {
+                LOG(LOG_INFO, std::fixed << std::setprecision(2) << "  " << zoneNames[z] << "  avg "
+                              << zoneMs[z] / frameMs.size() << " ms");
             }
         }
 
-        // Queue for reinsertion
-        updated.push_back(copy);
-        it = gameSprites.erase(it);
+        Uint32 recordedFrames = 0, recordedHash = 0, hash = worldStateHash();
+        if (record != INPUT_LOG_END || !read(recordedFrames) || !read(recordedHash)) {
+            LOG(LOG_WARN, "Input log ends without a final state (the recording did not exit cleanly); state "
+                          << std::hex << hash);
+        } else if (recordedFrames != frames || recordedHash != hash) {
+            LOG(LOG_WARN, "Replay diverged: state " << std::hex << hash << " after " << std::dec << frames
+                          << " frames, recorded " << std::hex << recordedHash << " after " << std::dec << recordedFrames);
+        } else {
+            LOG(LOG_INFO, "Replay matches the recording: state " << std::hex << hash);
+        }
+    }
+
+    // Close a recording with the final state, for replays to check against
+    void finish() {
+        if (mode != RECORD) return;
+        write(INPUT_LOG_END);
+        write(frames);
+        write(worldStateHash());
+        out.close();
+        LOG(LOG_INFO, "Recorded " << frames << " frames of input to " << path);
+        mode = OFF;
     }
+};
+
+InputLog inputLog;
 
-    // Reinsert updated NPCs
-    for (auto& s : updated) {
-        gameSprites.insert(std::move(s));
+void runSceneBenchmark() {
+    deltaTime = 1.0 / tickRate;
+    for (size_t count : benchSpriteCounts) {
+        generateSyntheticLevel(count);
+        animationClock = 0.0;
+        tickAccumulator = 0.0;
+        simulateFrame(0.0, renderFrames[0]);
+
+        double updateSeconds = 0.0, renderSeconds = 0.0;
+        size_t drawn = 0;
+        for (int frame = 0; frame < benchFrames; frame++) {
+            scriptedInput(frame);
+            auto start = std::chrono::steady_clock::now();
+            simulateFrame(deltaTime, renderFrames[0]);
+            auto simulated = std::chrono::steady_clock::now();
+            render(renderFrames[0]);
+            auto rendered = std::chrono::steady_clock::now();
+            updateSeconds += std::chrono::duration<double>(simulated - start).count();
+            renderSeconds += std::chrono::duration<double>(rendered - simulated).count();
+            drawn += drawOrder.size();
+        }
+
+        size_t live = 0;
+        for (const GameSprite& sprite : gameSprites) live += sprite.alive;
+        std::stringstream ss;
+        ss << std::fixed << std::setprecision(3)
+           << std::setw(7) << count << " sprites  " << std::setw(6) << live << " live  "
+           << std::setw(5) << drawn / benchFrames << " drawn  update "
+           << std::setw(8) << updateSeconds * 1000.0 / benchFrames << " ms/frame ("
+           << std::setprecision(0) << std::setw(6) << benchFrames / updateSeconds << " fps)  render "
+           << std::setprecision(3) << std::setw(8) << renderSeconds * 1000.0 / benchFrames << " ms/frame ("
+           << std::setprecision(0) << std::setw(6) << benchFrames / renderSeconds << " fps)  state "
+           << std::hex << worldStateHash();
+        std::cout << ss.str() << std::endl;
     }
 }
 
 // Main game loop
 int main(int argc, char* argv[]) {
+    countHeapAllocations = true;
+    logger.start();
+
+    // Parse command line options
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--no-vsync") {
+            vsyncEnabled = false;
+        } else if (arg.rfind("--profile-trace=", 0) == 0) {
+            profileTracePath = arg.substr(16);
+        } else if (arg == "--renderer=batched") {
+            spriteBackend = SPRITE_BACKEND_BATCHED;
+        } else if (arg == "--renderer=copy") {
+            spriteBackend = SPRITE_BACKEND_COPY;
+        } else if (arg == "--no-audio") {
+            audio.enabled = false;
+        } else if (arg == "--eager-animations") {
+            lazyAnimationsEnabled = false;
+        } else if (arg.rfind("--anim-vram-budget=", 0) == 0) {
+            animationLoader.budgetBytes = size_t(std::max(0, std::atoi(arg.c_str() + 19))) << 20;
+        } else if (arg == "--no-mipmaps") {
+            textureMipsEnabled = false;
+        } else if (arg == "--no-static-layers") {
+            staticLayersEnabled = false;
+        } else if (arg == "--hot-reload") {
+            hotReloader.enabled = true;
+        } else if (arg == "--check-allocations") {
+            allocationCheck.enabled = true;
+        } else if (arg == "--no-sim-thread") {
+            simulationThreadEnabled = false;
+        } else if (arg.rfind("--tick-rate=", 0) == 0) {
+            tickRate = std::max(1.0, std::atof(arg.c_str() + 12));
+        } else if (arg.rfind("--threads=", 0) == 0) {
+            workerThreads = static_cast<unsigned>(std::max(0, std::atoi(arg.c_str() + 10)));
+        } else if (arg.rfind("--simd=", 0) == 0) {
+            npcKernelOverride = arg.substr(7);
+        } else if (arg.rfind("--log-level=", 0) == 0) {
+            std::string name = arg.substr(12);
+            logLevel = name == "off" ? LOG_OFF : LOG_INFO;
+            for (int level = LOG_DEBUG; level < LOG_OFF; level++) {
+                if (name == logLevelNames[level]) logLevel = level;
+            }
+        } else if (arg == "--headless") {
+            headlessMode = true;
+        } else if (arg.rfind("--seed=", 0) == 0) {
+            simulationSeed = static_cast<Uint32>(std::strtoul(arg.c_str() + 7, nullptr, 10));
+        } else if (arg == "--bench" || arg.rfind("--bench=", 0) == 0) {
+            sceneBenchmark = true;
+            if (arg.size() > 8) {
+                benchSpriteCounts.clear();
+                std::stringstream counts(arg.substr(8));
+                std::string count;
+                while (std::getline(counts, count, ',')) benchSpriteCounts.push_back(std::strtoul(count.c_str(), nullptr, 10));
+            }
+        } else if (arg.rfind("--bench-frames=", 0) == 0) {
+            benchFrames = std::max(1, std::atoi(arg.c_str() + 15));
+        } else if (arg == "--bench-steering") {
+            runSteeringBenchmark();
+            return 0;
+        } else if (arg.rfind("--vram-budget=", 0) == 0) {
+            assetCache.budgetBytes = size_t(std::max(0, std::atoi(arg.c_str() + 14))) << 20;
+        } else if (arg.rfind("--bake=", 0) == 0) {
+            bakeLevelName = arg.substr(7);
+        } else if (arg.rfind("--record=", 0) == 0) {
+            recordPath = arg.substr(9);
+        } else if (arg.rfind("--replay=", 0) == 0) {
+            replayPath = arg.substr(9);
+        } else if (arg == "--replay-fast") {
+            inputLog.realTime = false;
+            vsyncEnabled = false;
+        }
+    }
+    selectNPCKernels();
+
+    // A replay starts from the settings it was recorded with
+    std::string startLevel = "level1";
+    if (!replayPath.empty()) {
+        if (!inputLog.startReplay(replayPath, startLevel)) return -1;
+        if (hotReloader.enabled) LOG(LOG_WARN, "Hot reload is disabled while replaying input");
+        hotReloader.enabled = false;
+    }
+
     // Initialize systems
+    jobSystem.start(workerThreads);
+    chunkStreamer.start();
+    animationLoader.start();
+
+    // Offline bake: write the level bundle and exit without opening a window
+    if (!bakeLevelName.empty()) {
+        bool baked = bakeLevel(bakeLevelName);
+        jobSystem.stop();
+        return baked ? 0 : -1;
+    }
+    if (sceneBenchmark) headlessMode = true;
     if (!initSDL()) return -1;
-    if (!loadLevel("level1")) return -1;
+    audio.start();
+    if (!loadLevel(startLevel)) return -1;
+#ifndef NDEBUG
+    checkStreamedWander();
+#endif
+    hotReloader.watchLevel();
+    if (sceneBenchmark) {
+        runSceneBenchmark();
+        cleanup();
+        return 0;
+    }
 
     // Initialize timing
     lastFrameTime = SDL_GetPerformanceCounter();
+    deltaTime = 1.0 / tickRate;
     bool running = true;
-    
-    // Main game loop
+    if (!recordPath.empty() && replayPath.empty() && !inputLog.startRecording(recordPath, startLevel)) return -1;
+    frameEvents.reserve(64);
+    if (simulationThreadEnabled) simulationThread.start();
+
+    // Record the first frame so there is always one ready to draw
+    simulateFrame(0.0, renderFrames[renderFront]);
+
+    // Main game loop: input once per frame, then the next frame is simulated
+    // in fixed ticks (interpolated between the last two) while the previous
+    // one is rendered and presented
     while (running) {
-        running = handleEvents();
-        updateNPCs();
-        render();
+        Uint64 currentTime = SDL_GetPerformanceCounter();
+        frameTime = (currentTime - lastFrameTime) / (double)SDL_GetPerformanceFrequency();
+        lastFrameTime = currentTime;
+
+        double elapsed = std::min(frameTime, MAX_FRAME_TIME);
+        {
+            ProfileScope scope(ZONE_INPUT);
+            running = handleEvents() && inputLog.frame(elapsed);
+        }
+        if (!running) break;
+
+        simulationThread.begin(elapsed, renderFrames[renderFront ^ 1]);
+        render(renderFrames[renderFront]);
+        {
+            ProfileScope scope(ZONE_AUDIO);
+            audio.play(renderFrames[renderFront].sounds);
+        }
+        {
+            ProfileScope scope(ZONE_SIM_WAIT);
+            simulationThread.wait();
+        }
+        animationLoader.update();
+        resendFailedLayers();
+        if (hotReloader.update(frameTime)) renderFrames[renderFront ^ 1] = RenderFrame();
+        renderFront ^= 1;
+        profiler.endFrame();
+        allocationCheck.endFrame(profiler.recent(0).allocations);
     }
+    simulationThread.stop();
+    inputLog.finish();
+    if (!profileTracePath.empty()) profiler.dumpTrace(profileTracePath);
 
     // Cleanup and exit
     cleanup();
-
-    for(auto a: npcStates)
-    {
-        std::cout << a.first << std::endl;
-    }
     return 0;
 }